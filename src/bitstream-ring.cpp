@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bitstream-ring.hpp"
+
+#include <cstring>
+
+namespace BitstreamRing {
+    static uint64_t align(uint64_t v) noexcept {
+        return (v + ALIGNMENT - 1) & ~static_cast<uint64_t>(ALIGNMENT - 1);
+    }
+
+    uint32_t sizeOf(uint32_t capacity) noexcept {
+        return static_cast<uint32_t>(sizeof(BitstreamRingHeader) + align(capacity));
+    }
+}
+
+BitstreamRingWriter::BitstreamRingWriter(char *data, uint32_t size, uint32_t capacity, uint32_t width, uint32_t height) noexcept {
+    const uint32_t CAPACITY{static_cast<uint32_t>(BitstreamRing::align(capacity))};
+    if ( (nullptr != data) && (2 * sizeof(BitstreamRingRecordHeader) <= CAPACITY) && (BitstreamRing::sizeOf(capacity) <= size) ) {
+        std::memset(data, 0, sizeof(BitstreamRingHeader));
+        m_header = reinterpret_cast<BitstreamRingHeader*>(data);
+        m_header->capacity = CAPACITY;
+        m_header->width = width;
+        m_header->height = height;
+        m_header->reserved.store(0, std::memory_order_relaxed);
+        m_header->committed.store(0, std::memory_order_relaxed);
+        m_header->newest.store(0, std::memory_order_relaxed);
+        m_data = reinterpret_cast<uint8_t*>(data + sizeof(BitstreamRingHeader));
+        m_header->version = BitstreamRing::VERSION;
+        std::atomic_thread_fence(std::memory_order_release);
+        // The magic is written last so that readers never see a half-initialized ring.
+        m_header->magic = BitstreamRing::MAGIC;
+    }
+}
+
+bool BitstreamRingWriter::valid() const noexcept {
+    return (nullptr != m_header);
+}
+
+bool BitstreamRingWriter::publish(const uint8_t *src, uint32_t length, const BitstreamRecord &record) noexcept {
+    const uint64_t CAPACITY{m_header ? m_header->capacity : 0};
+    const uint64_t LENGTH{BitstreamRing::align(sizeof(BitstreamRingRecordHeader) + static_cast<uint64_t>(length))};
+    if ( (nullptr == m_header) || (2 * LENGTH > CAPACITY) ) {
+        return false;
+    }
+
+    const uint64_t POSITION{m_header->committed.load(std::memory_order_relaxed)};
+    const uint64_t OFFSET{POSITION % CAPACITY};
+    // Records never wrap around the end of the data area.
+    const uint64_t START{(OFFSET + LENGTH > CAPACITY) ? (POSITION + CAPACITY - OFFSET) : POSITION};
+    const uint64_t END{START + LENGTH};
+
+    m_header->reserved.store(END, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    if (START != POSITION) {
+        BitstreamRingRecordHeader *wrap{reinterpret_cast<BitstreamRingRecordHeader*>(m_data + OFFSET)};
+        wrap->size = BitstreamRing::WRAP;
+    }
+    BitstreamRingRecordHeader *header{reinterpret_cast<BitstreamRingRecordHeader*>(m_data + (START % CAPACITY))};
+    header->size = length;
+    header->frameType = record.frameType;
+    header->number = ++m_number;
+    header->pts = record.pts;
+    header->dts = record.dts;
+    header->sampleTimeStampInMicroseconds = record.sampleTimeStampInMicroseconds;
+    header->keyframe = record.keyframe ? 1 : 0;
+    std::memcpy(reinterpret_cast<uint8_t*>(header) + sizeof(BitstreamRingRecordHeader), src, length);
+    m_header->newest.store(START, std::memory_order_release);
+    m_header->committed.store(END, std::memory_order_release);
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+BitstreamRingReader::BitstreamRingReader(char *data, uint32_t size) noexcept {
+    if ( (nullptr != data) && (sizeof(BitstreamRingHeader) <= size) ) {
+        BitstreamRingHeader *header{reinterpret_cast<BitstreamRingHeader*>(data)};
+        if ( (BitstreamRing::MAGIC == header->magic) &&
+             (BitstreamRing::VERSION == header->version) &&
+             (0 < header->capacity) &&
+             (BitstreamRing::sizeOf(header->capacity) <= size) ) {
+            m_header = header;
+            m_data = reinterpret_cast<uint8_t*>(data + sizeof(BitstreamRingHeader));
+            // Only records published after attaching are of interest.
+            m_position = m_header->committed.load(std::memory_order_acquire);
+        }
+    }
+}
+
+bool BitstreamRingReader::valid() const noexcept {
+    return (nullptr != m_header);
+}
+
+uint32_t BitstreamRingReader::width() const noexcept {
+    return (nullptr != m_header) ? m_header->width : 0;
+}
+
+uint32_t BitstreamRingReader::height() const noexcept {
+    return (nullptr != m_header) ? m_header->height : 0;
+}
+
+bool BitstreamRingReader::read(std::vector<uint8_t> &frame, BitstreamRecord &record) noexcept {
+    if (nullptr == m_header) {
+        return false;
+    }
+    const uint64_t CAPACITY{m_header->capacity};
+    while (true) {
+        const uint64_t COMMITTED{m_header->committed.load(std::memory_order_acquire)};
+        if (m_position == COMMITTED) {
+            return false;
+        }
+        if (COMMITTED - m_position > CAPACITY) {
+            // The writer overtook us; continue with its newest record.
+            m_position = m_header->newest.load(std::memory_order_acquire);
+            continue;
+        }
+
+        const uint64_t OFFSET{m_position % CAPACITY};
+        const BitstreamRingRecordHeader *header{reinterpret_cast<const BitstreamRingRecordHeader*>(m_data + OFFSET)};
+        BitstreamRingRecordHeader copy;
+        std::memcpy(&copy, header, sizeof(copy));
+        const bool WRAP{BitstreamRing::WRAP == copy.size};
+        const bool PLAUSIBLE{WRAP || (OFFSET + sizeof(BitstreamRingRecordHeader) + copy.size <= CAPACITY)};
+        if (PLAUSIBLE && !WRAP) {
+            frame.resize(copy.size);
+            std::memcpy(frame.data(), reinterpret_cast<const uint8_t*>(header) + sizeof(BitstreamRingRecordHeader), copy.size);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_header->reserved.load(std::memory_order_relaxed) - m_position > CAPACITY) {
+            // The record was overwritten while being copied.
+            m_position = m_header->newest.load(std::memory_order_acquire);
+            continue;
+        }
+        if (WRAP) {
+            m_position += CAPACITY - OFFSET;
+            continue;
+        }
+        if (!PLAUSIBLE) {
+            m_position = m_header->newest.load(std::memory_order_acquire);
+            continue;
+        }
+
+        m_position += BitstreamRing::align(sizeof(BitstreamRingRecordHeader) + copy.size);
+        if ( (0 < m_lastNumber) && (copy.number > m_lastNumber + 1) ) {
+            m_lost += copy.number - m_lastNumber - 1;
+        }
+        m_lastNumber = copy.number;
+        record.frameType = copy.frameType;
+        record.keyframe = (0 != copy.keyframe);
+        record.number = copy.number;
+        record.pts = copy.pts;
+        record.dts = copy.dts;
+        record.sampleTimeStampInMicroseconds = copy.sampleTimeStampInMicroseconds;
+        return true;
+    }
+}
+
+uint64_t BitstreamRingReader::lost() const noexcept {
+    return m_lost;
+}
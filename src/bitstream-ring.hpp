@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BITSTREAM_RING_HPP
+#define BITSTREAM_RING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Layout of a shared memory area holding a ring of variable-length records
+ * with encoded frames; all offsets are relative to cluon::SharedMemory::data():
+ *
+ *   [BitstreamRingHeader][data area of header.capacity bytes]
+ *
+ * Records are addressed by positions that count the bytes written since the
+ * ring was created; position p lives at offset p % capacity of the data area.
+ * Every record consists of a BitstreamRingRecordHeader followed by the
+ * encoded frame, starts at a multiple of 64 bytes, and never wraps around the
+ * end of the data area: when a record does not fit, the writer marks the rest
+ * of the data area with a record header of size WRAP and continues at the
+ * beginning. The writer publishes a record as follows:
+ *
+ *   1. header.reserved  = end of the record (the area up to here may be overwritten)
+ *   2. write the record header and the frame bytes
+ *   3. header.newest    = start of the record
+ *   4. header.committed = end of the record
+ *   5. cluon::SharedMemory::notifyAll()
+ *
+ * The writer never takes the shared memory lock. A reader follows the records
+ * from its own position up to header.committed and, after copying a record,
+ * checks that header.reserved has not advanced by more than capacity bytes
+ * beyond the record's start, i.e., that the record was not overwritten while
+ * being read. A reader that was overtaken continues at header.newest.
+ */
+struct BitstreamRingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t width;
+    uint32_t height;
+    uint32_t reserved0;
+    std::atomic<uint64_t> reserved;
+    std::atomic<uint64_t> committed;
+    std::atomic<uint64_t> newest;
+    uint8_t reserved1[16];
+};
+
+struct BitstreamRingRecordHeader {
+    uint32_t size;      // bytes of the encoded frame following this header
+    uint32_t frameType; // X264_TYPE_*
+    uint64_t number;    // records are numbered from 1
+    int64_t pts;
+    int64_t dts;
+    int64_t sampleTimeStampInMicroseconds;
+    uint32_t keyframe;
+    uint8_t reserved[20];
+};
+
+static_assert(64 == sizeof(BitstreamRingHeader), "BitstreamRingHeader must occupy 64 bytes.");
+static_assert(64 == sizeof(BitstreamRingRecordHeader), "BitstreamRingRecordHeader must occupy 64 bytes.");
+
+namespace BitstreamRing {
+    constexpr uint32_t MAGIC{0x48323634}; // 'H264'
+    constexpr uint32_t VERSION{1};
+    constexpr uint32_t ALIGNMENT{64};
+    constexpr uint32_t WRAP{0xFFFFFFFF};
+
+    /**
+     * @return Number of bytes required for a ring with a data area of
+     *         capacity bytes, which is rounded up to a multiple of 64.
+     */
+    uint32_t sizeOf(uint32_t capacity) noexcept;
+}
+
+/**
+ * Properties of one encoded frame in the ring.
+ */
+struct BitstreamRecord {
+    uint32_t frameType{0};
+    bool keyframe{false};
+    uint64_t number{0};
+    int64_t pts{0};
+    int64_t dts{0};
+    int64_t sampleTimeStampInMicroseconds{0};
+};
+
+/**
+ * This class publishes encoded frames into a bitstream ring.
+ */
+class BitstreamRingWriter {
+   private:
+    BitstreamRingWriter(const BitstreamRingWriter &) = delete;
+    BitstreamRingWriter(BitstreamRingWriter &&)      = delete;
+    BitstreamRingWriter &operator=(const BitstreamRingWriter &) = delete;
+    BitstreamRingWriter &operator=(BitstreamRingWriter &&) = delete;
+
+   public:
+    /**
+     * Initializes the ring header; size must be at least
+     * BitstreamRing::sizeOf(capacity).
+     */
+    BitstreamRingWriter(char *data, uint32_t size, uint32_t capacity, uint32_t width, uint32_t height) noexcept;
+
+    bool valid() const noexcept;
+
+    /**
+     * This method publishes an encoded frame as next record; the caller is
+     * responsible for calling cluon::SharedMemory::notifyAll() afterwards.
+     *
+     * @return false if the frame is larger than half of the capacity.
+     */
+    bool publish(const uint8_t *src, uint32_t length, const BitstreamRecord &record) noexcept;
+
+   private:
+    BitstreamRingHeader *m_header{nullptr};
+    uint8_t *m_data{nullptr};
+    uint64_t m_number{0};
+};
+
+/**
+ * This class reads all records of a bitstream ring in order without blocking
+ * the writer and serves as reference implementation for consumers:
+ *
+ *   cluon::SharedMemory sharedMemory{"video0.h264"};
+ *   BitstreamRingReader reader{sharedMemory.data(), sharedMemory.size()};
+ *   std::vector<uint8_t> frame;
+ *   BitstreamRecord record;
+ *   while (reader.valid()) {
+ *       sharedMemory.wait();
+ *       while (reader.read(frame, record)) {
+ *           // frame holds the NAL units of one access unit.
+ *       }
+ *   }
+ */
+class BitstreamRingReader {
+   private:
+    BitstreamRingReader(const BitstreamRingReader &) = delete;
+    BitstreamRingReader(BitstreamRingReader &&)      = delete;
+    BitstreamRingReader &operator=(const BitstreamRingReader &) = delete;
+    BitstreamRingReader &operator=(BitstreamRingReader &&) = delete;
+
+   public:
+    /**
+     * @param data Pointer to the user-accessible part of the shared memory.
+     * @param size Size of the user-accessible part of the shared memory.
+     */
+    BitstreamRingReader(char *data, uint32_t size) noexcept;
+
+    /**
+     * @return true if the shared memory area holds a valid bitstream ring.
+     */
+    bool valid() const noexcept;
+
+    uint32_t width() const noexcept;
+    uint32_t height() const noexcept;
+
+    /**
+     * This method copies the next record that was published after attaching.
+     *
+     * @param frame Destination for the encoded frame.
+     * @param record Properties of the encoded frame.
+     * @return true if a consistent record was copied.
+     */
+    bool read(std::vector<uint8_t> &frame, BitstreamRecord &record) noexcept;
+
+    /**
+     * @return Number of records that were overwritten before being read.
+     */
+    uint64_t lost() const noexcept;
+
+   private:
+    BitstreamRingHeader *m_header{nullptr};
+    uint8_t *m_data{nullptr};
+    uint64_t m_position{0};
+    uint64_t m_lastNumber{0};
+    uint64_t m_lost{0};
+};
+
+#endif
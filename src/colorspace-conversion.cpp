@@ -0,0 +1,301 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "colorspace-conversion.hpp"
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #include <arm_neon.h>
+    #define HAVE_NEON
+#endif
+
+bool parsePixelFormat(const std::string &name, PixelFormat &format) noexcept {
+    bool retVal{true};
+    if ("i420" == name) {
+        format = PixelFormat::I420;
+    }
+    else if ("nv12" == name) {
+        format = PixelFormat::NV12;
+    }
+    else if ("yuyv" == name) {
+        format = PixelFormat::YUYV;
+    }
+    else if ("uyvy" == name) {
+        format = PixelFormat::UYVY;
+    }
+    else if ("rgb" == name) {
+        format = PixelFormat::RGB;
+    }
+    else if ("bgr" == name) {
+        format = PixelFormat::BGR;
+    }
+    else if ("rgba" == name) {
+        format = PixelFormat::RGBA;
+    }
+    else if ("bgra" == name) {
+        format = PixelFormat::BGRA;
+    }
+    else {
+        retVal = false;
+    }
+    return retVal;
+}
+
+uint32_t frameSizeOf(PixelFormat format, uint32_t width, uint32_t height) noexcept {
+    switch (format) {
+        case PixelFormat::I420:
+        case PixelFormat::NV12: return width * height * 3 / 2;
+        case PixelFormat::YUYV:
+        case PixelFormat::UYVY: return width * height * 2;
+        case PixelFormat::RGB:
+        case PixelFormat::BGR: return width * height * 3;
+        case PixelFormat::RGBA:
+        case PixelFormat::BGRA: return width * height * 4;
+    }
+    return 0;
+}
+
+bool isNativeFormat(PixelFormat format) noexcept {
+    return (PixelFormat::I420 == format) || (PixelFormat::NV12 == format);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// BT.601 limited range.
+
+static inline uint8_t toY(int32_t r, int32_t g, int32_t b) noexcept {
+    return static_cast<uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+static inline uint8_t toU(int32_t r, int32_t g, int32_t b) noexcept {
+    return static_cast<uint8_t>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+}
+
+static inline uint8_t toV(int32_t r, int32_t g, int32_t b) noexcept {
+    return static_cast<uint8_t>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Packed YUV 4:2:2 (YUYV, UYVY); the chroma of two rows is averaged.
+
+// Converts two rows as far as possible with vector instructions and returns
+// the number of pixels processed.
+static uint32_t packedYUV422RowsSIMD(const uint8_t *s0, const uint8_t *s1,
+                                     uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                                     uint32_t width, bool lumaFirst) noexcept {
+    uint32_t x{0};
+#if defined(__SSE2__)
+    const __m128i MASK = _mm_set1_epi16(0x00FF);
+    const __m128i ZERO = _mm_setzero_si128();
+    for (; (x + 16) <= width; x += 16) {
+        const __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s0 + 2 * x));
+        const __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s0 + 2 * x + 16));
+        const __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s1 + 2 * x));
+        const __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s1 + 2 * x + 16));
+
+        __m128i ca, cb;
+        if (lumaFirst) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(y0 + x), _mm_packus_epi16(_mm_and_si128(a0, MASK), _mm_and_si128(a1, MASK)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(y1 + x), _mm_packus_epi16(_mm_and_si128(b0, MASK), _mm_and_si128(b1, MASK)));
+            ca = _mm_packus_epi16(_mm_srli_epi16(a0, 8), _mm_srli_epi16(a1, 8));
+            cb = _mm_packus_epi16(_mm_srli_epi16(b0, 8), _mm_srli_epi16(b1, 8));
+        }
+        else {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(y0 + x), _mm_packus_epi16(_mm_srli_epi16(a0, 8), _mm_srli_epi16(a1, 8)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(y1 + x), _mm_packus_epi16(_mm_srli_epi16(b0, 8), _mm_srli_epi16(b1, 8)));
+            ca = _mm_packus_epi16(_mm_and_si128(a0, MASK), _mm_and_si128(a1, MASK));
+            cb = _mm_packus_epi16(_mm_and_si128(b0, MASK), _mm_and_si128(b1, MASK));
+        }
+        // ca and cb hold U0 V0 U1 V1 ... for eight pixel pairs.
+        const __m128i c = _mm_avg_epu8(ca, cb);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(u + x / 2), _mm_packus_epi16(_mm_and_si128(c, MASK), ZERO));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(v + x / 2), _mm_packus_epi16(_mm_srli_epi16(c, 8), ZERO));
+    }
+#elif defined(HAVE_NEON)
+    const int L0{lumaFirst ? 0 : 1};
+    const int C0{lumaFirst ? 1 : 0};
+    for (; (x + 16) <= width; x += 16) {
+        const uint8x8x4_t a = vld4_u8(s0 + 2 * x);
+        const uint8x8x4_t b = vld4_u8(s1 + 2 * x);
+        uint8x8x2_t ya, yb;
+        ya.val[0] = a.val[L0];
+        ya.val[1] = a.val[L0 + 2];
+        yb.val[0] = b.val[L0];
+        yb.val[1] = b.val[L0 + 2];
+        vst2_u8(y0 + x, ya);
+        vst2_u8(y1 + x, yb);
+        vst1_u8(u + x / 2, vrhadd_u8(a.val[C0], b.val[C0]));
+        vst1_u8(v + x / 2, vrhadd_u8(a.val[C0 + 2], b.val[C0 + 2]));
+    }
+#else
+    (void)s0; (void)s1; (void)y0; (void)y1; (void)u; (void)v; (void)width; (void)lumaFirst;
+#endif
+    return x;
+}
+
+static void packedYUV422ToI420(const uint8_t *src, uint32_t width, uint32_t height, bool lumaFirst,
+                               uint8_t *dstY, int32_t strideY,
+                               uint8_t *dstU, int32_t strideU,
+                               uint8_t *dstV, int32_t strideV) noexcept {
+    const uint32_t L{lumaFirst ? 0u : 1u};
+    const uint32_t C{lumaFirst ? 1u : 0u};
+    for (uint32_t row{0}; row < height; row += 2) {
+        const uint8_t *s0{src + row * width * 2};
+        const uint8_t *s1{s0 + width * 2};
+        uint8_t *y0{dstY + row * strideY};
+        uint8_t *y1{y0 + strideY};
+        uint8_t *u{dstU + (row / 2) * strideU};
+        uint8_t *v{dstV + (row / 2) * strideV};
+
+        uint32_t x{packedYUV422RowsSIMD(s0, s1, y0, y1, u, v, width, lumaFirst)};
+        for (; x < width; x += 2) {
+            const uint8_t *p0{s0 + 2 * x};
+            const uint8_t *p1{s1 + 2 * x};
+            y0[x]     = p0[L];
+            y0[x + 1] = p0[L + 2];
+            y1[x]     = p1[L];
+            y1[x + 1] = p1[L + 2];
+            u[x / 2]  = static_cast<uint8_t>((p0[C] + p1[C] + 1) >> 1);
+            v[x / 2]  = static_cast<uint8_t>((p0[C + 2] + p1[C + 2] + 1) >> 1);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Packed RGB; luma is vectorized as it dominates the cost, chroma is
+// computed from the average of each 2x2 block.
+
+#if defined(__SSE2__)
+// Returns the weighted sums of four 4-byte pixels as 32-bit lanes.
+static inline __m128i weightedSumOf4Pixels(__m128i px, __m128i coefficients) noexcept {
+    const __m128i ZERO = _mm_setzero_si128();
+    __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(px, ZERO), coefficients);
+    __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(px, ZERO), coefficients);
+    lo = _mm_add_epi32(lo, _mm_srli_epi64(lo, 32));
+    hi = _mm_add_epi32(hi, _mm_srli_epi64(hi, 32));
+    lo = _mm_shuffle_epi32(lo, _MM_SHUFFLE(3, 3, 2, 0));
+    hi = _mm_shuffle_epi32(hi, _MM_SHUFFLE(3, 3, 2, 0));
+    return _mm_unpacklo_epi64(lo, hi);
+}
+#endif
+
+static uint32_t lumaRowSIMD(const uint8_t *s, uint8_t *y, uint32_t width,
+                            uint32_t bytesPerPixel, uint32_t r, uint32_t g, uint32_t b) noexcept {
+    uint32_t x{0};
+#if defined(__SSE2__)
+    if (4 == bytesPerPixel) {
+        int16_t c[4]{0, 0, 0, 0};
+        c[r] = 66;
+        c[g] = 129;
+        c[b] = 25;
+        const __m128i COEFFICIENTS = _mm_setr_epi16(c[0], c[1], c[2], c[3], c[0], c[1], c[2], c[3]);
+        const __m128i ROUNDING = _mm_set1_epi32(128);
+        const __m128i OFFSET = _mm_set1_epi16(16);
+        for (; (x + 16) <= width; x += 16) {
+            __m128i p[4];
+            for (uint32_t i{0}; i < 4; i++) {
+                const __m128i px = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + 4 * (x + 4 * i)));
+                p[i] = _mm_srai_epi32(_mm_add_epi32(weightedSumOf4Pixels(px, COEFFICIENTS), ROUNDING), 8);
+            }
+            const __m128i lo = _mm_add_epi16(_mm_packs_epi32(p[0], p[1]), OFFSET);
+            const __m128i hi = _mm_add_epi16(_mm_packs_epi32(p[2], p[3]), OFFSET);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(y + x), _mm_packus_epi16(lo, hi));
+        }
+    }
+#elif defined(HAVE_NEON)
+    const uint8x8_t CR = vdup_n_u8(66);
+    const uint8x8_t CG = vdup_n_u8(129);
+    const uint8x8_t CB = vdup_n_u8(25);
+    const uint16x8_t ROUNDING = vdupq_n_u16(128);
+    const uint8x8_t OFFSET = vdup_n_u8(16);
+    if (3 == bytesPerPixel) {
+        for (; (x + 8) <= width; x += 8) {
+            const uint8x8x3_t px = vld3_u8(s + 3 * x);
+            uint16x8_t acc = vmull_u8(px.val[r], CR);
+            acc = vmlal_u8(acc, px.val[g], CG);
+            acc = vmlal_u8(acc, px.val[b], CB);
+            vst1_u8(y + x, vadd_u8(vshrn_n_u16(vaddq_u16(acc, ROUNDING), 8), OFFSET));
+        }
+    }
+    else if (4 == bytesPerPixel) {
+        for (; (x + 8) <= width; x += 8) {
+            const uint8x8x4_t px = vld4_u8(s + 4 * x);
+            uint16x8_t acc = vmull_u8(px.val[r], CR);
+            acc = vmlal_u8(acc, px.val[g], CG);
+            acc = vmlal_u8(acc, px.val[b], CB);
+            vst1_u8(y + x, vadd_u8(vshrn_n_u16(vaddq_u16(acc, ROUNDING), 8), OFFSET));
+        }
+    }
+#else
+    (void)s; (void)y; (void)width; (void)bytesPerPixel; (void)r; (void)g; (void)b;
+#endif
+    return x;
+}
+
+static void packedRGBToI420(const uint8_t *src, uint32_t width, uint32_t height,
+                            uint32_t bytesPerPixel, uint32_t r, uint32_t g, uint32_t b,
+                            uint8_t *dstY, int32_t strideY,
+                            uint8_t *dstU, int32_t strideU,
+                            uint8_t *dstV, int32_t strideV) noexcept {
+    const uint32_t STRIDE{width * bytesPerPixel};
+    for (uint32_t row{0}; row < height; row += 2) {
+        const uint8_t *s0{src + row * STRIDE};
+        const uint8_t *s1{s0 + STRIDE};
+        uint8_t *y0{dstY + row * strideY};
+        uint8_t *y1{y0 + strideY};
+        uint8_t *u{dstU + (row / 2) * strideU};
+        uint8_t *v{dstV + (row / 2) * strideV};
+
+        for (uint32_t i{0}; i < 2; i++) {
+            const uint8_t *s{(0 == i) ? s0 : s1};
+            uint8_t *y{(0 == i) ? y0 : y1};
+            for (uint32_t x{lumaRowSIMD(s, y, width, bytesPerPixel, r, g, b)}; x < width; x++) {
+                const uint8_t *p{s + x * bytesPerPixel};
+                y[x] = toY(p[r], p[g], p[b]);
+            }
+        }
+
+        for (uint32_t x{0}; x < width; x += 2) {
+            const uint8_t *p0{s0 + x * bytesPerPixel};
+            const uint8_t *p1{s1 + x * bytesPerPixel};
+            const int32_t R{(p0[r] + p0[bytesPerPixel + r] + p1[r] + p1[bytesPerPixel + r] + 2) >> 2};
+            const int32_t G{(p0[g] + p0[bytesPerPixel + g] + p1[g] + p1[bytesPerPixel + g] + 2) >> 2};
+            const int32_t B{(p0[b] + p0[bytesPerPixel + b] + p1[b] + p1[bytesPerPixel + b] + 2) >> 2};
+            u[x / 2] = toU(R, G, B);
+            v[x / 2] = toV(R, G, B);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool convertToI420(PixelFormat format, const uint8_t *src, uint32_t width, uint32_t height,
+                   uint8_t *dstY, int32_t strideY,
+                   uint8_t *dstU, int32_t strideU,
+                   uint8_t *dstV, int32_t strideV) noexcept {
+    bool retVal{true};
+    switch (format) {
+        case PixelFormat::YUYV: packedYUV422ToI420(src, width, height, true, dstY, strideY, dstU, strideU, dstV, strideV); break;
+        case PixelFormat::UYVY: packedYUV422ToI420(src, width, height, false, dstY, strideY, dstU, strideU, dstV, strideV); break;
+        case PixelFormat::RGB: packedRGBToI420(src, width, height, 3, 0, 1, 2, dstY, strideY, dstU, strideU, dstV, strideV); break;
+        case PixelFormat::BGR: packedRGBToI420(src, width, height, 3, 2, 1, 0, dstY, strideY, dstU, strideU, dstV, strideV); break;
+        case PixelFormat::RGBA: packedRGBToI420(src, width, height, 4, 0, 1, 2, dstY, strideY, dstU, strideU, dstV, strideV); break;
+        case PixelFormat::BGRA: packedRGBToI420(src, width, height, 4, 2, 1, 0, dstY, strideY, dstU, strideU, dstV, strideV); break;
+        default: retVal = false;
+    }
+    return retVal;
+}
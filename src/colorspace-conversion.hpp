@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COLORSPACE_CONVERSION_HPP
+#define COLORSPACE_CONVERSION_HPP
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Pixel formats accepted in the shared memory area.
+ */
+enum class PixelFormat {
+    I420,
+    NV12,
+    YUYV,
+    UYVY,
+    RGB,
+    BGR,
+    RGBA,
+    BGRA,
+};
+
+/**
+ * @param name Name of the pixel format (i420, nv12, yuyv, uyvy, rgb, bgr, rgba, bgra).
+ * @param format Parsed pixel format.
+ * @return true if name denotes a known pixel format.
+ */
+bool parsePixelFormat(const std::string &name, PixelFormat &format) noexcept;
+
+/**
+ * @return Number of bytes of one frame in the given format.
+ */
+uint32_t frameSizeOf(PixelFormat format, uint32_t width, uint32_t height) noexcept;
+
+/**
+ * @return true if the format can be passed to x264 without conversion.
+ */
+bool isNativeFormat(PixelFormat format) noexcept;
+
+/**
+ * This function converts a packed YUV 4:2:2 or RGB frame into I420 using
+ * BT.601 limited range; width and height must be even. The planes of the
+ * destination are usually the ones of x264's input picture.
+ *
+ * @return false if format cannot be converted.
+ */
+bool convertToI420(PixelFormat format, const uint8_t *src, uint32_t width, uint32_t height,
+                   uint8_t *dstY, int32_t strideY,
+                   uint8_t *dstU, int32_t strideU,
+                   uint8_t *dstV, int32_t strideV) noexcept;
+
+#endif
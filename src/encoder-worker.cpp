@@ -0,0 +1,1230 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "encoder-worker.hpp"
+#include "forward-error-correction.hpp"
+#include "opendlv-standard-message-set.hpp"
+#include "opendlv-video-x264-encoder-message-set.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+EncoderWorker::EncoderWorker(const EncoderWorkerConfiguration &configuration, cluon::OD4Session *od4) noexcept
+    : m_configuration{configuration}
+    , m_od4{od4}
+    , m_logPrefix{"[opendlv-video-x264-encoder/" + configuration.name + "]: "}
+    , m_current{configuration} {
+    // Formats other than I420 and NV12 are converted into x264's own input picture.
+    m_convert = !isNativeFormat(m_configuration.format);
+    // Renditions are scaled into x264's own input picture, too.
+    m_convert = m_convert || m_configuration.rendition;
+    m_frameSize = frameSizeOf(m_configuration.format, m_configuration.width, m_configuration.height);
+}
+
+EncoderWorker::~EncoderWorker() noexcept {
+    stop();
+    if (nullptr != m_encoder) {
+        x264_encoder_close(m_encoder);
+        m_encoder = nullptr;
+    }
+    if (m_pictureAllocated) {
+        x264_picture_clean(&m_pictureIn);
+        m_pictureAllocated = false;
+    }
+}
+
+const EncoderWorkerConfiguration &EncoderWorker::configuration() const noexcept {
+    return m_configuration;
+}
+
+EncoderWorkerStatistics EncoderWorker::statistics() const noexcept {
+    std::lock_guard<std::mutex> lck(m_statisticsMutex);
+    return m_statistics;
+}
+
+bool EncoderWorker::isRunning() const noexcept {
+    return m_running.load();
+}
+
+void EncoderWorker::setPlanes(uint8_t *frame) noexcept {
+    const uint32_t WIDTH{m_configuration.width};
+    const uint32_t HEIGHT{m_configuration.height};
+    m_pictureIn.img.plane[0] = frame;
+    m_pictureIn.img.plane[1] = frame + (WIDTH * HEIGHT);
+    m_pictureIn.img.i_stride[0] = WIDTH;
+    if (PixelFormat::NV12 == m_configuration.format) {
+        // Interleaved UV plane at full width.
+        m_pictureIn.img.plane[2] = nullptr;
+        m_pictureIn.img.i_stride[1] = WIDTH;
+        m_pictureIn.img.i_stride[2] = 0;
+    }
+    else {
+        m_pictureIn.img.plane[2] = frame + (WIDTH * HEIGHT + ((WIDTH * HEIGHT) >> 2));
+        m_pictureIn.img.i_stride[1] = WIDTH/2;
+        m_pictureIn.img.i_stride[2] = WIDTH/2;
+    }
+    m_pictureIn.img.i_stride[3] = 0;
+}
+
+bool EncoderWorker::makeParameters(const EncoderWorkerConfiguration &configuration, x264_param_t &parameters) const noexcept {
+    if (0 != x264_param_default_preset(&parameters, configuration.preset.c_str(), "zerolatency")) {
+        std::cerr << m_logPrefix << "Failed to load preset parameters (" << configuration.preset << ", zerolatency) for x264." << std::endl;
+        return false;
+    }
+    parameters.i_width  = m_configuration.width;
+    parameters.i_height = m_configuration.height;
+    parameters.i_log_level = (configuration.verbose ? X264_LOG_INFO : X264_LOG_NONE);
+    parameters.i_csp = (PixelFormat::NV12 == configuration.format) ? X264_CSP_NV12 : X264_CSP_I420;
+    parameters.i_bitdepth = 8;
+    // Sliced threads split each frame among the threads and thus keep the
+    // latency at zero frames; frame threads scale better but delay the
+    // output by one frame per additional thread.
+    parameters.i_threads = static_cast<int>(configuration.threads);
+    parameters.b_sliced_threads = (configuration.slicedThreads ? 1 : 0);
+    parameters.i_keyint_min = configuration.gop;
+    parameters.i_keyint_max = configuration.gop;
+    if (configuration.lossRecovery) {
+        // Invalidating a lost reference leaves older ones to refer to.
+        parameters.i_frame_reference = std::max(parameters.i_frame_reference, 4);
+    }
+    if (configuration.intraRefresh) {
+        // Instead of periodic IDR frames, a column of intra macroblocks
+        // sweeps across the picture once per GOP; only the first frame is
+        // an IDR frame and the frame sizes stay nearly constant.
+        parameters.b_intra_refresh = 1;
+    }
+    parameters.i_fps_num = configuration.fps;
+    parameters.i_fps_den = 1;
+    if (configuration.vfr) {
+        // Presentation time stamps are given in microseconds so that
+        // rate control follows the real timing of the frames.
+        parameters.b_vfr_input = 1;
+        parameters.i_timebase_num = 1;
+        parameters.i_timebase_den = 1000 * 1000;
+    }
+    else {
+        parameters.b_vfr_input = 0;
+    }
+    parameters.b_repeat_headers = 1;
+    parameters.b_annexb = 1;
+    if (0 < configuration.sliceMaxSize) {
+        // Every slice is published in its own datagram.
+        parameters.i_slice_max_size = static_cast<int>(configuration.sliceMaxSize);
+    }
+
+    // Rate control; the VBV buffer is never larger than the per-frame cap
+    // so that a single frame cannot exceed what fits into one datagram.
+    const uint32_t BITRATE{configuration.bitrate};
+    uint32_t vbvMaxrate{configuration.vbvMaxrate};
+    uint32_t vbvBufsize{configuration.vbvBufsize};
+    switch (configuration.rateControl) {
+        case RateControl::PRESET:
+            break;
+        case RateControl::CRF:
+            parameters.rc.i_rc_method = X264_RC_CRF;
+            parameters.rc.f_rf_constant = configuration.crf;
+            break;
+        case RateControl::ABR:
+            parameters.rc.i_rc_method = X264_RC_ABR;
+            parameters.rc.i_bitrate = static_cast<int>(BITRATE);
+            break;
+        case RateControl::CBR:
+            parameters.rc.i_rc_method = X264_RC_ABR;
+            parameters.rc.i_bitrate = static_cast<int>(BITRATE);
+            vbvMaxrate = BITRATE;
+            vbvBufsize = (0 != vbvBufsize) ? vbvBufsize : BITRATE / std::max(configuration.fps, 1u);
+            break;
+    }
+    if (0 < vbvMaxrate) {
+        const uint32_t CAP_IN_KBIT{configuration.maxFrameSize * 8 / 1000};
+        vbvBufsize = (0 == vbvBufsize) ? CAP_IN_KBIT : vbvBufsize;
+        if ( (0 < CAP_IN_KBIT) && (vbvBufsize > CAP_IN_KBIT) ) {
+            vbvBufsize = CAP_IN_KBIT;
+        }
+        parameters.rc.i_vbv_max_bitrate = static_cast<int>(vbvMaxrate);
+        parameters.rc.i_vbv_buffer_size = static_cast<int>(vbvBufsize);
+    }
+
+    if (0 != x264_param_apply_profile(&parameters, "baseline")) {
+        std::cerr << m_logPrefix << "Failed to apply parameters for x264." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void EncoderWorker::printParameters() const noexcept {
+    x264_param_t actual;
+    x264_encoder_parameters(m_encoder, &actual);
+    const char *RC_METHODS[]{"CQP", "CRF", "ABR"};
+    std::clog << m_logPrefix << "Rate control " << RC_METHODS[actual.rc.i_rc_method % 3] << "; rate factor " << actual.rc.f_rf_constant << "; bitrate " << actual.rc.i_bitrate << " kbit/s; VBV maxrate " << actual.rc.i_vbv_max_bitrate << " kbit/s, bufsize " << actual.rc.i_vbv_buffer_size << " kbit; frame cap " << m_current.maxFrameSize << " bytes." << std::endl;
+    std::clog << m_logPrefix << "Encoding with " << actual.i_threads << " " << (actual.b_sliced_threads ? "sliced" : "frame") << " thread(s); maximum delay " << x264_encoder_maximum_delayed_frames(m_encoder) << " frame(s)." << std::endl;
+}
+
+bool EncoderWorker::open() noexcept {
+    const std::string &NAME{m_configuration.name};
+    const uint32_t WIDTH{m_configuration.width};
+    const uint32_t HEIGHT{m_configuration.height};
+
+    // Renditions receive their frames from the worker reading the shared memory.
+    if (!m_configuration.rendition) {
+        m_sharedMemory.reset(new cluon::SharedMemory{NAME});
+        if (!m_sharedMemory || !m_sharedMemory->valid()) {
+            std::cerr << m_logPrefix << "Failed to attach to shared memory '" << NAME << "'." << std::endl;
+            return false;
+        }
+        std::clog << m_logPrefix << "Attached to '" << m_sharedMemory->name() << "' (" << m_sharedMemory->size() << " bytes)." << std::endl;
+    }
+    if (!m_renditions.empty()) {
+        if (PixelFormat::NV12 == m_configuration.format) {
+            std::cerr << m_logPrefix << "Renditions cannot be scaled from nv12 frames." << std::endl;
+            return false;
+        }
+        uint32_t smallestWidth{WIDTH};
+        uint32_t smallestHeight{HEIGHT};
+        for (EncoderWorker *r : m_renditions) {
+            smallestWidth = std::min(smallestWidth, r->configuration().width);
+            smallestHeight = std::min(smallestHeight, r->configuration().height);
+        }
+        m_pyramid.reset(new ScalingPyramid(WIDTH, HEIGHT, smallestWidth, smallestHeight));
+    }
+
+    if (!makeParameters(m_current, m_parameters)) {
+        return false;
+    }
+
+    if (0 < m_configuration.queueSize) {
+        // Twice the limit leaves room for the drop policy to choose from
+        // while the sending thread is busy with a frame.
+        m_queue.reset(new SpscQueue<EncodedFrame>(2 * m_configuration.queueSize));
+    }
+    if (!m_configuration.outputRing.empty()) {
+        m_outputSharedMemory.reset(new cluon::SharedMemory{m_configuration.outputRing, BitstreamRing::sizeOf(m_configuration.outputRingSize)});
+        if (!m_outputSharedMemory->valid()) {
+            std::cerr << m_logPrefix << "Failed to create shared memory '" << m_configuration.outputRing << "'." << std::endl;
+            return false;
+        }
+        m_outputRing.reset(new BitstreamRingWriter(m_outputSharedMemory->data(), m_outputSharedMemory->size(), m_configuration.outputRingSize, m_configuration.width, m_configuration.height));
+        if (!m_outputRing->valid()) {
+            std::cerr << m_logPrefix << "Failed to create ring of " << m_configuration.outputRingSize << " bytes in '" << m_outputSharedMemory->name() << "'." << std::endl;
+            return false;
+        }
+        std::clog << m_logPrefix << "Publishing encoded frames into '" << m_outputSharedMemory->name() << "' (" << m_outputSharedMemory->size() << " bytes)." << std::endl;
+    }
+    if (!m_configuration.record.empty()) {
+        // Frames queue up to this many bytes while the disk is busy.
+        constexpr uint64_t MAX_QUEUED_BYTES{64 * 1024 * 1024};
+        m_recorder.reset(new Recorder(m_configuration.record, m_configuration.width, m_configuration.height, m_configuration.id,
+                                      m_configuration.recordMaxSize, m_configuration.recordMaxDuration, MAX_QUEUED_BYTES));
+        if (!m_recorder->valid()) {
+            return false;
+        }
+    }
+    if (!m_configuration.rtpAddress.empty()) {
+        constexpr uint32_t IP_AND_UDP_HEADERS{20 + 8};
+        m_rtpPacketizer.reset(new RtpPacketizer(m_configuration.mtu - IP_AND_UDP_HEADERS, m_configuration.rtpMode));
+        m_rtpSender.reset(new EnvelopeSender(m_configuration.rtpAddress, m_configuration.rtpPort));
+        if (!m_rtpSender->valid()) {
+            std::cerr << m_logPrefix << "Failed to create socket for RTP to " << m_configuration.rtpAddress << ":" << m_configuration.rtpPort << "." << std::endl;
+            return false;
+        }
+        m_rtpSender->setMtu(m_configuration.mtu);
+        std::clog << m_logPrefix << "Sending RTP to " << m_configuration.rtpAddress << ":" << m_configuration.rtpPort << " described by" << std::endl
+                  << m_rtpPacketizer->sdp(m_configuration.rtpAddress, m_configuration.rtpPort);
+        if (0 < m_configuration.pacing) {
+            m_rtpPacer.reset(new Pacer(m_configuration.pacingBurst));
+            m_rtpSender->enablePacing(m_configuration.pacingKernel);
+        }
+    }
+    if (m_configuration.zeroCopy || m_configuration.batch || (0 < m_configuration.pacing) || (nullptr == m_od4)) {
+        m_envelopeSender.reset(new EnvelopeSender(m_configuration.cid));
+        if (!m_envelopeSender->valid()) {
+            std::cerr << m_logPrefix << "Failed to create socket for OD4Session " << m_configuration.cid << "." << std::endl;
+            return false;
+        }
+        m_envelopeSender->setMtu(m_configuration.mtu);
+    }
+    if (0 < m_configuration.pacing) {
+        m_pacer.reset(new Pacer(m_configuration.pacingBurst));
+        const PacingMode MODE{m_envelopeSender->enablePacing(m_configuration.pacingKernel)};
+        if (m_configuration.verbose) {
+            std::clog << m_logPrefix << "Pacing datagrams over " << m_configuration.pacing << "% of the frame interval "
+                      << ((PacingMode::TXTIME == MODE) ? "with SO_TXTIME" : ((PacingMode::MAX_PACING_RATE == MODE) ? "with SO_MAX_PACING_RATE" : "in user space")) << "." << std::endl;
+        }
+    }
+
+    // Initialize picture to pass YUV420 data into encoder.
+    if (m_convert) {
+        // The conversion kernels write directly into x264's picture.
+        if (0 != x264_picture_alloc(&m_pictureIn, X264_CSP_I420, WIDTH, HEIGHT)) {
+            std::cerr << m_logPrefix << "Failed to allocate picture for x264." << std::endl;
+            return false;
+        }
+        m_pictureAllocated = true;
+    }
+    else {
+        x264_picture_init(&m_pictureIn);
+        m_pictureIn.img.i_csp = m_parameters.i_csp;
+        m_pictureIn.img.i_plane = (PixelFormat::NV12 == m_configuration.format) ? 2 : 3;
+    }
+    m_pictureIn.i_type = X264_TYPE_AUTO;
+
+    // In snapshot mode, the frame is copied into a private buffer so
+    // that the producer is only blocked for the duration of the copy;
+    // x264 copies the picture into its own frame before returning
+    // from x264_encoder_encode, so a small pool suffices. Converted
+    // formats do not need the pool as the conversion itself already
+    // produces a private copy, unless the frame comes from a ring.
+    const uint32_t NUMBER_OF_SNAPSHOT_BUFFERS{2};
+    if (m_configuration.ring) {
+        m_ring.reset(new SharedMemoryRingReader(m_sharedMemory->data(), m_sharedMemory->size()));
+        if (!m_ring->valid() || (m_ring->slotSize() < m_frameSize)) {
+            std::cerr << m_logPrefix << "Shared memory '" << NAME << "' does not hold a ring of " << WIDTH << "x" << HEIGHT << " " << m_configuration.formatName << " frames." << std::endl;
+            return false;
+        }
+    }
+    if (!m_configuration.rendition && !m_configuration.ring && (m_sharedMemory->size() < m_frameSize)) {
+        std::cerr << m_logPrefix << "Shared memory '" << NAME << "' is too small for a " << WIDTH << "x" << HEIGHT << " " << m_configuration.formatName << " frame." << std::endl;
+        return false;
+    }
+    if (m_configuration.ring || (m_configuration.snapshot && !m_convert)) {
+        m_snapshots.reset(new FrameBufferPool(NUMBER_OF_SNAPSHOT_BUFFERS, m_frameSize));
+        if (!m_snapshots->valid()) {
+            std::cerr << m_logPrefix << "Failed to allocate snapshot buffers." << std::endl;
+            return false;
+        }
+    }
+    else if (!m_convert && !m_configuration.rendition) {
+        // Directly point to the shared memory.
+        m_sharedMemory->lock();
+        {
+            setPlanes(reinterpret_cast<uint8_t*>(m_sharedMemory->data()));
+        }
+        m_sharedMemory->unlock();
+    }
+
+    // Open h264 encoder.
+    m_encoder = x264_encoder_open(&m_parameters);
+    if (nullptr == m_encoder) {
+        std::cerr << m_logPrefix << "Failed to open x264 encoder." << std::endl;
+        return false;
+    }
+    if (m_configuration.verbose) {
+        printParameters();
+    }
+    return true;
+}
+
+void EncoderWorker::control(const opendlv::proxy::ImageEncoderControl &control) noexcept {
+    // Several messages before the next frame are merged field by field.
+    std::lock_guard<std::mutex> lck(m_controlMutex);
+    if (0 < control.bitrate()) {
+        m_control.bitrate(control.bitrate());
+    }
+    if (0 < control.vbvMaxrate()) {
+        m_control.vbvMaxrate(control.vbvMaxrate());
+    }
+    if (0 < control.vbvBufsize()) {
+        m_control.vbvBufsize(control.vbvBufsize());
+    }
+    if (0.0f < control.crf()) {
+        m_control.crf(control.crf());
+    }
+    if (0 < control.gop()) {
+        m_control.gop(control.gop());
+    }
+    if (!control.preset().empty()) {
+        m_control.preset(control.preset());
+    }
+    m_hasControl = true;
+}
+
+void EncoderWorker::requestKeyframe() noexcept {
+    m_keyframeRequested.store(true);
+    std::lock_guard<std::mutex> lck(m_statisticsMutex);
+    m_statistics.keyframeRequests++;
+}
+
+void EncoderWorker::reportLoss(const opendlv::proxy::ImageLossReport &report) noexcept {
+    {
+        // Only the oldest loss before the next frame matters.
+        std::lock_guard<std::mutex> lck(m_lossMutex);
+        if (!m_hasLossReport) {
+            m_lossReport = report;
+            m_lossReported = std::chrono::steady_clock::now();
+            m_hasLossReport = true;
+        }
+    }
+    std::lock_guard<std::mutex> lck(m_statisticsMutex);
+    m_statistics.lossReports++;
+}
+
+void EncoderWorker::applyLossReport() noexcept {
+    opendlv::proxy::ImageLossReport report;
+    {
+        std::lock_guard<std::mutex> lck(m_lossMutex);
+        if (!m_hasLossReport) {
+            return;
+        }
+        report = m_lossReport;
+        m_hasLossReport = false;
+        m_recoveryStarted = m_lossReported;
+    }
+    m_recovering = true;
+
+    // x264 drops all references from the given pts on, so the next frame is
+    // a P-frame referring to the newest intact frame.
+    bool invalidated{false};
+    if (m_configuration.lossRecovery) {
+        for (const auto &published : m_publishedPts) {
+            const bool LOST{(0 != report.firstLost()) ? (published.second == report.firstLost()) : (published.second > report.lastReceived())};
+            if (LOST) {
+                invalidated = (0 == x264_encoder_invalidate_reference(m_encoder, published.first));
+                break;
+            }
+        }
+    }
+    if (invalidated) {
+        std::lock_guard<std::mutex> lck(m_statisticsMutex);
+        m_statistics.invalidations++;
+    }
+    else {
+        requestKeyframe();
+    }
+}
+
+void EncoderWorker::applyControl() noexcept {
+    opendlv::proxy::ImageEncoderControl control;
+    {
+        std::lock_guard<std::mutex> lck(m_controlMutex);
+        // Changes arriving during a rebuild wait for the new encoder.
+        if (!m_hasControl || m_rebuildThread.joinable()) {
+            return;
+        }
+        control = m_control;
+        m_control = opendlv::proxy::ImageEncoderControl{};
+        m_hasControl = false;
+    }
+
+    EncoderWorkerConfiguration next{m_current};
+    if (0.0f < control.crf()) {
+        next.rateControl = RateControl::CRF;
+        next.crf = control.crf();
+    }
+    if (0 < control.bitrate()) {
+        next.bitrate = control.bitrate();
+        if ( (RateControl::PRESET == next.rateControl) || (RateControl::CRF == next.rateControl) ) {
+            next.rateControl = RateControl::ABR;
+        }
+    }
+    next.vbvMaxrate = (0 < control.vbvMaxrate()) ? control.vbvMaxrate() : next.vbvMaxrate;
+    next.vbvBufsize = (0 < control.vbvBufsize()) ? control.vbvBufsize() : next.vbvBufsize;
+    next.gop = (0 < control.gop()) ? control.gop() : next.gop;
+    next.preset = (!control.preset().empty()) ? control.preset() : next.preset;
+
+    x264_param_t parameters;
+    if (!makeParameters(next, parameters)) {
+        return;
+    }
+
+    // x264_encoder_reconfig takes over the rate factor at any time, but
+    // bitrate and VBV only when VBV was enabled when opening the encoder;
+    // preset, GOP, and rate control method are fixed.
+    x264_param_t current;
+    x264_encoder_parameters(m_encoder, &current);
+    const bool VBV{(0 < current.rc.i_vbv_max_bitrate) && (0 < parameters.rc.i_vbv_max_bitrate)};
+    const bool RATE_CHANGED{(current.rc.i_bitrate != parameters.rc.i_bitrate)
+                            || (current.rc.i_vbv_max_bitrate != parameters.rc.i_vbv_max_bitrate)
+                            || (current.rc.i_vbv_buffer_size != parameters.rc.i_vbv_buffer_size)};
+    const bool RECONFIGURABLE{(next.preset == m_current.preset)
+                              && (next.gop == m_current.gop)
+                              && (current.rc.i_rc_method == parameters.rc.i_rc_method)
+                              && (!RATE_CHANGED || VBV)};
+    if (RECONFIGURABLE) {
+        current.rc.f_rf_constant = parameters.rc.f_rf_constant;
+        current.rc.i_bitrate = parameters.rc.i_bitrate;
+        current.rc.i_vbv_max_bitrate = parameters.rc.i_vbv_max_bitrate;
+        current.rc.i_vbv_buffer_size = parameters.rc.i_vbv_buffer_size;
+        if (0 > x264_encoder_reconfig(m_encoder, &current)) {
+            std::cerr << m_logPrefix << "Failed to reconfigure x264 encoder." << std::endl;
+            return;
+        }
+        m_current = next;
+        std::clog << m_logPrefix << "Reconfigured x264 encoder." << std::endl;
+        if (m_configuration.verbose) {
+            printParameters();
+        }
+    }
+    else {
+        // Opening an encoder takes longer than a frame; meanwhile, the
+        // current encoder continues.
+        m_next = next;
+        m_nextParameters = parameters;
+        m_rebuildDone.store(false);
+        m_rebuildThread = std::thread([this]() {
+            m_nextEncoder = x264_encoder_open(&m_nextParameters);
+            m_rebuildDone.store(true);
+        });
+        std::clog << m_logPrefix << "Opening new x264 encoder (preset " << next.preset << ", GOP " << next.gop << ") in the background." << std::endl;
+    }
+}
+
+void EncoderWorker::swapEncoder() noexcept {
+    m_rebuildThread.join();
+    m_rebuildDone.store(false);
+    if (nullptr == m_nextEncoder) {
+        std::cerr << m_logPrefix << "Failed to open new x264 encoder; keeping the current one." << std::endl;
+        return;
+    }
+
+    // The first frame of the new encoder is an IDR frame with its own SPS
+    // and PPS, so decoders switch over seamlessly.
+    flushDelayedFrames();
+    x264_encoder_close(m_encoder);
+    m_encoder = m_nextEncoder;
+    m_nextEncoder = nullptr;
+    m_parameters = m_nextParameters;
+    m_current = m_next;
+    std::clog << m_logPrefix << "Switched to new x264 encoder." << std::endl;
+    if (m_configuration.verbose) {
+        printParameters();
+    }
+}
+
+void EncoderWorker::flushDelayedFrames() noexcept {
+    // Frame threads and the lookahead keep frames inside the encoder; they
+    // are published, queued, and recorded like all others.
+    x264_nal_t *nals{nullptr};
+    int i_nals{0};
+    x264_picture_t pictureOut;
+    while ( (nullptr != m_encoder) && (0 < x264_encoder_delayed_frames(m_encoder)) ) {
+        const int FRAME_SIZE{x264_encoder_encode(m_encoder, &nals, &i_nals, nullptr, &pictureOut)};
+        if (0 > FRAME_SIZE) {
+            break;
+        }
+        if (0 < FRAME_SIZE) {
+            // publish() replaces this by the sample time stamp of the picture.
+            cluon::data::TimeStamp sampleTimeStamp{cluon::time::now()};
+            publish(nals, i_nals, FRAME_SIZE, pictureOut, sampleTimeStamp);
+        }
+    }
+}
+
+void EncoderWorker::publishToOutputRing(const uint8_t *data, uint32_t size, const x264_picture_t &pictureOut, const cluon::data::TimeStamp &sampleTimeStamp) noexcept {
+    const cluon::data::TimeStamp PUBLISHING{cluon::time::now()};
+    BitstreamRecord record;
+    record.frameType = static_cast<uint32_t>(pictureOut.i_type);
+    record.keyframe = (0 != pictureOut.b_keyframe);
+    record.pts = pictureOut.i_pts;
+    record.dts = pictureOut.i_dts;
+    record.sampleTimeStampInMicroseconds = cluon::time::toMicroseconds(sampleTimeStamp);
+    const bool PUBLISHED{m_outputRing->publish(data, size, record)};
+    if (PUBLISHED) {
+        m_outputSharedMemory->notifyAll();
+    }
+    const int64_t PUBLISHING_TIME{cluon::time::deltaInMicroseconds(cluon::time::now(), PUBLISHING)};
+    std::lock_guard<std::mutex> lck(m_statisticsMutex);
+    m_statistics.outputRingFrames += (PUBLISHED ? 1 : 0);
+    m_statistics.outputRingOversized += (PUBLISHED ? 0 : 1);
+    m_statistics.outputRingMicroseconds += static_cast<uint64_t>(std::max<int64_t>(0, PUBLISHING_TIME));
+}
+
+void EncoderWorker::publish(x264_nal_t *nals, int i_nals, int frameSize, const x264_picture_t &pictureOut, cluon::data::TimeStamp &sampleTimeStamp) noexcept {
+    // With frame threads, the output belongs to an earlier picture.
+    while (!m_pendingSampleTimeStamps.empty() && (m_pendingSampleTimeStamps.front().first <= pictureOut.i_pts)) {
+        if (m_pendingSampleTimeStamps.front().first == pictureOut.i_pts) {
+            sampleTimeStamp = m_pendingSampleTimeStamps.front().second;
+        }
+        m_pendingSampleTimeStamps.pop_front();
+    }
+    if (m_configuration.lossRecovery) {
+        // More than the references that x264 keeps.
+        constexpr std::size_t HISTORY{64};
+        m_publishedPts.emplace_back(pictureOut.i_pts, cluon::time::toMicroseconds(sampleTimeStamp));
+        if (m_publishedPts.size() > HISTORY) {
+            m_publishedPts.pop_front();
+        }
+    }
+
+    // NAL units that other frames refer to have a non-zero nal_ref_idc.
+    bool reference{false};
+    for (int i{0}; i < i_nals; i++) {
+        reference |= (NAL_PRIORITY_DISPOSABLE != nals[i].i_ref_idc);
+    }
+
+    opendlv::proxy::ImageEncoderFrameInfo info;
+    if (m_configuration.frameInfo) {
+        info.frameType(static_cast<uint32_t>(pictureOut.i_type))
+            .keyframe(0 != pictureOut.b_keyframe)
+            .reference(reference)
+            .pts(pictureOut.i_pts)
+            .dts(pictureOut.i_dts)
+            .rateFactor(static_cast<float>(pictureOut.prop.f_crf_avg))
+            .frameSize(static_cast<uint32_t>(frameSize))
+            .encodingDuration(static_cast<uint32_t>(std::max<int64_t>(0, m_encodingMicroseconds)))
+            .lockingDuration(static_cast<uint32_t>(std::max<int64_t>(0, m_lockingMicroseconds)));
+    }
+
+    // x264 places the payloads of all NAL units of a frame back to back.
+    if (m_outputRing) {
+        publishToOutputRing(nals->p_payload, static_cast<uint32_t>(frameSize), pictureOut, sampleTimeStamp);
+    }
+    if (m_recorder) {
+        m_recorder->record(nals->p_payload, static_cast<uint32_t>(frameSize), sampleTimeStamp, 0 != pictureOut.b_keyframe);
+    }
+    if (m_queue) {
+        EncodedFrame *frame{m_queue->back()};
+        if (nullptr == frame) {
+            // The sending thread is stuck; the newest frame is dropped.
+            {
+                std::lock_guard<std::mutex> lck(m_statisticsMutex);
+                m_statistics.droppedFrames++;
+                m_statistics.droppedReferenceFrames += (reference ? 1 : 0);
+            }
+            if (reference) {
+                requestKeyframe();
+            }
+        }
+        else {
+            frame->data.assign(nals->p_payload, nals->p_payload + frameSize);
+            frame->nalSizes.clear();
+            for (int i{0}; i < i_nals; i++) {
+                frame->nalSizes.push_back(static_cast<uint32_t>(nals[i].i_payload));
+            }
+            frame->sampleTimeStamp = sampleTimeStamp;
+            frame->reference = reference;
+            frame->dropped = false;
+            frame->info = info;
+            m_queue->push();
+            {
+                // Pairs with the predicate check of the sending thread.
+                std::lock_guard<std::mutex> lck(m_queueMutex);
+            }
+            m_queueCondition.notify_one();
+        }
+    }
+    else {
+        m_nalSizes.clear();
+        for (int i{0}; i < i_nals; i++) {
+            m_nalSizes.push_back(static_cast<uint32_t>(nals[i].i_payload));
+        }
+        send(nals->p_payload, static_cast<uint32_t>(frameSize), m_nalSizes, sampleTimeStamp, info);
+    }
+
+    const uint64_t SIZE{static_cast<uint64_t>(frameSize)};
+    const uint32_t CAP{m_current.maxFrameSize};
+    const bool ABOVE_CAP{(0 < CAP) && (SIZE > CAP)};
+    const bool NEAR_CAP{(0 < CAP) && !ABOVE_CAP && (SIZE * 10 >= static_cast<uint64_t>(CAP) * 9)};
+    std::lock_guard<std::mutex> lck(m_statisticsMutex);
+    if (m_recorder) {
+        m_statistics.recordedBytes = m_recorder->bytesWritten();
+        m_statistics.recordDroppedFrames = m_recorder->droppedFrames();
+        m_statistics.recordFiles = m_recorder->files();
+    }
+    m_statistics.frames++;
+    m_statistics.bytes += SIZE;
+    m_statistics.bytesSquaredSum += static_cast<double>(SIZE) * static_cast<double>(SIZE);
+    m_statistics.peakFrameSize = std::max<uint64_t>(m_statistics.peakFrameSize, SIZE);
+    m_statistics.rateFactorSum += pictureOut.prop.f_crf_avg;
+    if (m_recovering) {
+        m_statistics.recoveryFrames++;
+        m_statistics.recoveryBytes += SIZE;
+        m_statistics.recoveryMicroseconds += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - m_recoveryStarted).count());
+        m_recovering = false;
+    }
+    if (ABOVE_CAP) {
+        m_statistics.framesAboveCap++;
+    }
+    if (NEAR_CAP) {
+        m_statistics.framesNearCap++;
+        m_statistics.rateFactorSumNearCap += pictureOut.prop.f_crf_avg;
+    }
+}
+
+void EncoderWorker::send(const uint8_t *data, uint32_t size, const std::vector<uint32_t> &nalSizes, const cluon::data::TimeStamp &sampleTimeStamp, opendlv::proxy::ImageEncoderFrameInfo &info) noexcept {
+    const cluon::data::TimeStamp PUBLISHING{cluon::time::now()};
+    if (0 < m_configuration.sliceMaxSize) {
+        publishSlices(data, nalSizes, sampleTimeStamp);
+    }
+    else if (size > m_configuration.fragmentSize) {
+        // UDPSender drops datagrams above 65,507 bytes silently.
+        publishFragments(data, size, sampleTimeStamp);
+    }
+    else if (m_configuration.zeroCopy && !m_pacer) {
+        m_envelopeSender->sendImageReading(data, size, m_configuration.width, m_configuration.height, sampleTimeStamp, m_configuration.id);
+    }
+    else {
+        opendlv::proxy::ImageReading ir;
+        ir.fourcc("h264").width(m_configuration.width).height(m_configuration.height).data(std::string(reinterpret_cast<const char*>(data), size));
+        sendMessage(ir, sampleTimeStamp);
+    }
+    // The datagrams of the frame depart within the given part of the frame
+    // interval; the following frame info departs at the same rate.
+    const int64_t PACING_WINDOW{static_cast<int64_t>(m_configuration.pacing) * 1000 * 1000 / (100 * static_cast<int64_t>(std::max(m_configuration.fps, 1u)))};
+    if (m_pacer) {
+        uint64_t bytes{0};
+        for (const auto &datagram : m_datagrams) {
+            bytes += datagram.size();
+        }
+        m_pacer->startFrame(bytes, PACING_WINDOW);
+    }
+    sendBatch();
+    if (!m_streamServers.empty()) {
+        // Stream sockets are not limited in size and get whole frames.
+        opendlv::proxy::ImageReading ir;
+        ir.fourcc("h264").width(m_configuration.width).height(m_configuration.height).data(std::string(reinterpret_cast<const char*>(data), size));
+        const std::string ENVELOPE{EnvelopeSender::serialize(ir, sampleTimeStamp, m_configuration.id)};
+        for (StreamServer *server : m_streamServers) {
+            server->publish(ENVELOPE);
+        }
+    }
+    if (m_rtpPacketizer) {
+        m_rtpPackets.clear();
+        m_rtpPacketizer->packetize(data, nalSizes, sampleTimeStamp, m_rtpPackets);
+        if (m_rtpPacer) {
+            uint64_t bytes{0};
+            for (const auto &packet : m_rtpPackets) {
+                bytes += packet.size();
+            }
+            m_rtpPacer->startFrame(bytes, PACING_WINDOW);
+            m_rtpSender->sendPaced(m_rtpPackets, *m_rtpPacer);
+        }
+        else {
+            m_rtpSender->sendBatch(m_rtpPackets);
+        }
+    }
+    const int64_t PUBLISHING_TIME{cluon::time::deltaInMicroseconds(cluon::time::now(), PUBLISHING)};
+    if (m_configuration.frameInfo) {
+        // Sent after the frame so that it includes the time to send the frame.
+        info.sendingDuration(static_cast<uint32_t>(std::max<int64_t>(0, PUBLISHING_TIME)));
+        sendMessage(info, sampleTimeStamp);
+        sendBatch();
+        if (!m_streamServers.empty()) {
+            const std::string ENVELOPE{EnvelopeSender::serialize(info, sampleTimeStamp, m_configuration.id)};
+            for (StreamServer *server : m_streamServers) {
+                server->publish(ENVELOPE);
+            }
+        }
+    }
+    std::lock_guard<std::mutex> lck(m_statisticsMutex);
+    if (m_rtpPacketizer) {
+        m_statistics.rtpPackets = m_rtpSender->datagrams();
+        m_statistics.rtpOversized = m_rtpPacketizer->oversized();
+    }
+    if (m_pacer) {
+        const Pacer *RTP{m_rtpPacer.get()};
+        m_statistics.pacedDatagrams = m_pacer->datagrams() + (RTP ? RTP->datagrams() : 0);
+        m_statistics.pacingDelayMicroseconds = m_pacer->delayMicroseconds() + (RTP ? RTP->delayMicroseconds() : 0);
+        m_statistics.pacingPeakDelayMicroseconds = std::max(m_pacer->peakDelayMicroseconds(), RTP ? RTP->peakDelayMicroseconds() : 0);
+        m_statistics.pacingPeakBurst = std::max(m_pacer->peakBurst(), RTP ? RTP->peakBurst() : 0);
+        m_statistics.pacingDropped = m_pacer->dropped() + (RTP ? RTP->dropped() : 0);
+    }
+    m_statistics.publishingMicroseconds += static_cast<uint64_t>(std::max<int64_t>(0, PUBLISHING_TIME));
+    // Every send of the OD4Session is one datagram and one system call.
+    m_statistics.datagrams = m_datagramsViaOD4 + (m_envelopeSender ? m_envelopeSender->datagrams() : 0);
+    m_statistics.systemCalls = m_datagramsViaOD4 + (m_envelopeSender ? m_envelopeSender->systemCalls() : 0);
+}
+
+void EncoderWorker::addStreamServer(StreamServer *server) noexcept {
+    if (nullptr != server) {
+        m_streamServers.push_back(server);
+    }
+}
+
+void EncoderWorker::sendBatch() noexcept {
+    if (!m_datagrams.empty()) {
+        if (m_pacer) {
+            m_envelopeSender->sendPaced(m_datagrams, *m_pacer);
+        }
+        else {
+            m_envelopeSender->sendBatch(m_datagrams);
+        }
+        m_datagrams.clear();
+    }
+}
+
+void EncoderWorker::sendQueuedFrames() noexcept {
+    const uint32_t LIMIT{m_configuration.queueSize};
+    // Frames marked as dropped that are still in the queue.
+    uint32_t dropped{0};
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lck(m_queueMutex);
+            m_queueCondition.wait(lck, [this]() { return m_stopSending || (0 < m_queue->size()); });
+            if (m_stopSending && (0 == m_queue->size())) {
+                break;
+            }
+        }
+
+        // Frames beyond the limit are dropped; as the encoding thread only
+        // appends, frames in the middle of the queue can be marked safely.
+        const uint32_t SIZE{m_queue->size()};
+        while ((SIZE - dropped) > LIMIT) {
+            uint32_t victim{SIZE};
+            if (DropPolicy::NON_REFERENCE == m_configuration.dropPolicy) {
+                for (uint32_t i{0}; (i < SIZE) && (SIZE == victim); i++) {
+                    victim = (!m_queue->at(i)->dropped && !m_queue->at(i)->reference) ? i : victim;
+                }
+            }
+            for (uint32_t i{0}; (i < SIZE) && (SIZE == victim); i++) {
+                victim = (!m_queue->at(i)->dropped) ? i : victim;
+            }
+            EncodedFrame *frame{m_queue->at(victim)};
+            frame->dropped = true;
+            dropped++;
+            {
+                std::lock_guard<std::mutex> lck(m_statisticsMutex);
+                m_statistics.droppedFrames++;
+                m_statistics.droppedReferenceFrames += (frame->reference ? 1 : 0);
+            }
+            if (frame->reference) {
+                // Later frames refer to the lost one; a keyframe ends the artifacts.
+                requestKeyframe();
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lck(m_statisticsMutex);
+            m_statistics.queueDepth = SIZE - dropped;
+            m_statistics.peakQueueDepth = std::max(m_statistics.peakQueueDepth, SIZE - dropped);
+        }
+
+        EncodedFrame *frame{m_queue->at(0)};
+        if (frame->dropped) {
+            dropped--;
+        }
+        else {
+            send(frame->data.data(), static_cast<uint32_t>(frame->data.size()), frame->nalSizes, frame->sampleTimeStamp, frame->info);
+        }
+        m_queue->pop();
+    }
+}
+
+void EncoderWorker::publishSlices(const uint8_t *data, const std::vector<uint32_t> &nalSizes, const cluon::data::TimeStamp &sampleTimeStamp) noexcept {
+    // Group consecutive NAL units greedily so that parameter sets and SEI
+    // travel together with the following slice as long as they fit.
+    const uint32_t BUDGET{m_configuration.sliceMaxSize};
+    const std::size_t NALS{nalSizes.size()};
+    std::vector<std::pair<std::size_t, std::size_t>> units;
+    std::size_t first{0};
+    uint32_t size{0};
+    for (std::size_t i{0}; i < NALS; i++) {
+        if ( (i > first) && ((size + nalSizes[i]) > BUDGET) ) {
+            units.emplace_back(first, i);
+            first = i;
+            size = 0;
+        }
+        size += nalSizes[i];
+    }
+    if (first < NALS) {
+        units.emplace_back(first, NALS);
+    }
+
+    const uint32_t FRAME_ID{m_frameId++};
+    std::size_t offset{0};
+    for (std::size_t u{0}; u < units.size(); u++) {
+        std::size_t length{0};
+        for (std::size_t i{units[u].first}; i < units[u].second; i++) {
+            length += nalSizes[i];
+        }
+
+        opendlv::proxy::ImageReadingSlice slice;
+        slice.fourcc("h264")
+             .width(m_configuration.width)
+             .height(m_configuration.height)
+             .frameId(FRAME_ID)
+             .sliceIndex(static_cast<uint32_t>(u))
+             .sliceCount(static_cast<uint32_t>(units.size()))
+             .data(std::string(reinterpret_cast<const char*>(data + offset), length));
+        sendMessage(slice, sampleTimeStamp);
+        offset += length;
+    }
+}
+void EncoderWorker::publishFragments(const uint8_t *data, uint32_t size, const cluon::data::TimeStamp &sampleTimeStamp) noexcept {
+    const uint32_t FRAGMENT_SIZE{m_configuration.fragmentSize};
+    const uint32_t COUNT{(size + FRAGMENT_SIZE - 1) / FRAGMENT_SIZE};
+    const uint32_t FRAME_ID{m_frameId++};
+    for (uint32_t i{0}; i < COUNT; i++) {
+        const uint32_t OFFSET{i * FRAGMENT_SIZE};
+        const uint32_t LENGTH{std::min(FRAGMENT_SIZE, size - OFFSET)};
+
+        opendlv::proxy::ImageReadingFragment fragment;
+        fragment.fourcc("h264")
+                .width(m_configuration.width)
+                .height(m_configuration.height)
+                .frameId(FRAME_ID)
+                .fragmentIndex(i)
+                .fragmentCount(COUNT)
+                .frameSize(size)
+                .offset(OFFSET)
+                .data(std::string(reinterpret_cast<const char*>(data + OFFSET), LENGTH));
+        sendMessage(fragment, sampleTimeStamp);
+    }
+
+    // Repairs follow the fragments so that receivers without losses complete
+    // the frame as early as without forward error correction.
+    const uint32_t REPAIRS{(COUNT * m_configuration.fec + 99) / 100};
+    const bool PROTECTED{(0 < REPAIRS) && ((COUNT + REPAIRS) <= ForwardErrorCorrection::MAX_SYMBOLS)};
+    const auto ENCODING{std::chrono::steady_clock::now()};
+    if (PROTECTED) {
+        std::string repair(FRAGMENT_SIZE, '\0');
+        for (uint32_t i{0}; i < REPAIRS; i++) {
+            ForwardErrorCorrection::encode(data, size, FRAGMENT_SIZE, i, reinterpret_cast<uint8_t*>(&repair[0]));
+
+            opendlv::proxy::ImageReadingRepair message;
+            message.frameId(FRAME_ID)
+                   .repairIndex(i)
+                   .repairCount(REPAIRS)
+                   .fragmentCount(COUNT)
+                   .fragmentSize(FRAGMENT_SIZE)
+                   .frameSize(size)
+                   .data(repair);
+            sendMessage(message, sampleTimeStamp);
+        }
+    }
+    const auto ENCODED{std::chrono::steady_clock::now()};
+
+    std::lock_guard<std::mutex> lck(m_statisticsMutex);
+    m_statistics.fragmentedFrames++;
+    if (PROTECTED) {
+        m_statistics.repairDatagrams += REPAIRS;
+        m_statistics.repairMicroseconds += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(ENCODED - ENCODING).count());
+    }
+    else if (0 < m_configuration.fec) {
+        m_statistics.unprotectedFrames++;
+    }
+}
+
+void EncoderWorker::start() noexcept {
+    if ( (nullptr != m_encoder) && !m_running.load() ) {
+        m_stop.store(false);
+        m_running.store(true);
+        if (m_queue) {
+            m_stopSending = false;
+            m_sendingThread = std::thread(&EncoderWorker::sendQueuedFrames, this);
+        }
+        m_thread = std::thread(m_configuration.rendition ? &EncoderWorker::runRendition : &EncoderWorker::run, this);
+    }
+}
+
+void EncoderWorker::stop() noexcept {
+    m_stop.store(true);
+    if (m_thread.joinable()) {
+        // Wake up the thread in case it is waiting for a frame.
+        if (m_sharedMemory && m_sharedMemory->valid()) {
+            m_sharedMemory->notifyAll();
+        }
+        if (m_ring) {
+            m_ring->wakeUp();
+        }
+        {
+            std::lock_guard<std::mutex> lck(m_inputMutex);
+        }
+        m_inputCondition.notify_one();
+        m_thread.join();
+    }
+}
+
+int EncoderWorker::encode(const cluon::data::TimeStamp &sampleTimeStamp, x264_nal_t **nals, int *i_nals, x264_picture_t *pictureOut) noexcept {
+    if (m_configuration.vfr) {
+        // x264 requires strictly monotonic time stamps.
+        const int64_t PTS{cluon::time::toMicroseconds(sampleTimeStamp)};
+        if ( (0 < m_frameCounter) && (PTS > m_lastPts) ) {
+            constexpr double ALPHA{0.1};
+            const double INTERVAL{static_cast<double>(PTS - m_lastPts)};
+            m_averageFrameIntervalInMicroseconds = (0.0 < m_averageFrameIntervalInMicroseconds) ? ((1.0 - ALPHA) * m_averageFrameIntervalInMicroseconds + ALPHA * INTERVAL) : INTERVAL;
+        }
+        m_pictureIn.i_pts = ((0 < m_frameCounter) && (PTS <= m_lastPts)) ? m_lastPts + 1 : PTS;
+        m_lastPts = m_pictureIn.i_pts;
+        m_frameCounter++;
+    }
+    else {
+        m_pictureIn.i_pts = m_frameCounter++;
+    }
+    applyLossReport();
+    // Requests within the minimum interval stay pending so that
+    // the requesting receiver still gets its keyframe in time.
+    bool forceKeyframe{false};
+    if (m_keyframeRequested.load()) {
+        const auto NOW{std::chrono::steady_clock::now()};
+        if ((NOW - m_lastForcedKeyframe) >= std::chrono::milliseconds(m_configuration.minKeyframeInterval)) {
+            m_keyframeRequested.store(false);
+            m_lastForcedKeyframe = NOW;
+            forceKeyframe = true;
+        }
+    }
+    if (forceKeyframe && m_current.intraRefresh) {
+        // Start a new refresh wave instead of a large IDR frame.
+        x264_encoder_intra_refresh(m_encoder);
+    }
+    else if (forceKeyframe) {
+        m_pictureIn.i_type = X264_TYPE_IDR;
+    }
+    m_pendingSampleTimeStamps.emplace_back(m_pictureIn.i_pts, sampleTimeStamp);
+    const auto ENCODING{std::chrono::steady_clock::now()};
+    const int frameSize{x264_encoder_encode(m_encoder, nals, i_nals, &m_pictureIn, pictureOut)};
+    const auto ENCODED{std::chrono::steady_clock::now()};
+    m_pictureIn.i_type = X264_TYPE_AUTO;
+    std::lock_guard<std::mutex> lck(m_statisticsMutex);
+    m_encodingMicroseconds = std::chrono::duration_cast<std::chrono::microseconds>(ENCODED - ENCODING).count();
+    m_statistics.encodingMicroseconds += static_cast<uint64_t>(m_encodingMicroseconds);
+    if (forceKeyframe) {
+        m_statistics.forcedKeyframes++;
+    }
+    return frameSize;
+}
+
+void EncoderWorker::addRendition(EncoderWorker *rendition) noexcept {
+    if (nullptr != rendition) {
+        m_renditions.push_back(rendition);
+    }
+}
+
+void EncoderWorker::feedRenditions(const cluon::data::TimeStamp &sampleTimeStamp) noexcept {
+    const auto SCALING{std::chrono::steady_clock::now()};
+    m_pyramid->build(m_pictureIn.img.plane, m_pictureIn.img.i_stride);
+    for (EncoderWorker *r : m_renditions) {
+        r->receive(*m_pyramid, sampleTimeStamp);
+    }
+    const auto SCALED{std::chrono::steady_clock::now()};
+    std::lock_guard<std::mutex> lck(m_statisticsMutex);
+    m_statistics.scalingMicroseconds += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(SCALED - SCALING).count());
+}
+
+void EncoderWorker::receive(const ScalingPyramid &pyramid, const cluon::data::TimeStamp &sampleTimeStamp) noexcept {
+    {
+        std::lock_guard<std::mutex> lck(m_inputMutex);
+        if (InputState::ENCODING == m_inputState) {
+            // The encoding thread still needs the picture; this frame is
+            // skipped instead of delaying the other renditions.
+            std::lock_guard<std::mutex> lck2(m_statisticsMutex);
+            m_statistics.skippedFrames++;
+            return;
+        }
+        if (InputState::FILLED == m_inputState) {
+            std::lock_guard<std::mutex> lck2(m_statisticsMutex);
+            m_statistics.skippedFrames++;
+        }
+        m_inputState = InputState::WRITING;
+    }
+    pyramid.scale(m_configuration.width, m_configuration.height, m_pictureIn.img.plane, m_pictureIn.img.i_stride);
+    {
+        std::lock_guard<std::mutex> lck(m_inputMutex);
+        m_inputState = InputState::FILLED;
+        m_inputSampleTimeStamp = sampleTimeStamp;
+    }
+    m_inputCondition.notify_one();
+}
+
+void EncoderWorker::runRendition() noexcept {
+    const bool VERBOSE{m_configuration.verbose};
+    x264_picture_t picture_out;
+    x264_nal_t *nals{nullptr};
+    int i_nals{0};
+    while ( !m_stop.load() && ((nullptr == m_od4) || m_od4->isRunning()) ) {
+        cluon::data::TimeStamp sampleTimeStamp;
+        {
+            std::unique_lock<std::mutex> lck(m_inputMutex);
+            m_inputCondition.wait(lck, [this]() { return m_stop.load() || (InputState::FILLED == m_inputState); });
+            if (m_stop.load()) {
+                break;
+            }
+            m_inputState = InputState::ENCODING;
+            sampleTimeStamp = m_inputSampleTimeStamp;
+        }
+
+        applyControl();
+        if (m_rebuildDone.load()) {
+            swapEncoder();
+        }
+        const auto BEFORE{std::chrono::steady_clock::now()};
+        const int frameSize{encode(sampleTimeStamp, &nals, &i_nals, &picture_out)};
+        const auto AFTER{std::chrono::steady_clock::now()};
+        {
+            std::lock_guard<std::mutex> lck(m_inputMutex);
+            m_inputState = InputState::EMPTY;
+        }
+
+        if (0 < frameSize) {
+            publish(nals, i_nals, frameSize, picture_out, sampleTimeStamp);
+            if (VERBOSE) {
+                std::clog << m_logPrefix << "Frame size = " << frameSize << " bytes; rate factor = " << picture_out.prop.f_crf_avg << "; sample time = " << cluon::time::toMicroseconds(sampleTimeStamp) << " microseconds; encoding took " << std::chrono::duration_cast<std::chrono::microseconds>(AFTER - BEFORE).count() << " microseconds." << std::endl;
+            }
+        }
+    }
+    finish();
+}
+
+void EncoderWorker::run() noexcept {
+    const uint32_t WIDTH{m_configuration.width};
+    const uint32_t HEIGHT{m_configuration.height};
+    const bool SNAPSHOT{m_configuration.snapshot};
+    const bool RING{m_configuration.ring};
+    const bool CONVERT{m_convert};
+    const bool VFR{m_configuration.vfr};
+    const bool VERBOSE{m_configuration.verbose};
+    const bool TIMING{VERBOSE || m_configuration.frameInfo};
+
+    cluon::data::TimeStamp before, after, locked, unlocked, converting, converted, sampleTimeStamp;
+
+    x264_picture_t picture_out;
+    x264_nal_t *nals{nullptr};
+    int i_nals{0};
+    int frameSize{0};
+    while ( !m_stop.load() && (m_sharedMemory && m_sharedMemory->valid()) && ((nullptr == m_od4) || m_od4->isRunning()) ) {
+        // Wait for incoming frame; in ring mode, frames published
+        // while encoding are picked up without waiting.
+        if (RING) {
+            if (!m_ring->waitForNewFrame()) {
+                continue;
+            }
+        }
+        else {
+            m_sharedMemory->wait();
+        }
+        if (m_stop.load()) {
+            break;
+        }
+
+        // Settings changed over OD4 take effect between two frames.
+        applyControl();
+        if (m_rebuildDone.load()) {
+            swapEncoder();
+        }
+
+        sampleTimeStamp = cluon::time::now();
+
+        const uint8_t *frame{nullptr};
+        if (RING) {
+            if (TIMING) {
+                locked = unlocked = cluon::time::now();
+            }
+            uint8_t *snapshot{m_snapshots->next()};
+            int64_t sampleTimeInMicroseconds{0};
+            if (!m_ring->readNewest(snapshot, m_frameSize, sampleTimeInMicroseconds)) {
+                continue;
+            }
+            sampleTimeStamp = (0 != sampleTimeInMicroseconds) ? cluon::time::fromMicroseconds(sampleTimeInMicroseconds) : sampleTimeStamp;
+            frame = snapshot;
+        }
+        else {
+            m_sharedMemory->lock();
+            if (TIMING) {
+                locked = cluon::time::now();
+            }
+            {
+                // Read notification timestamp.
+                auto r = m_sharedMemory->getTimeStamp();
+                sampleTimeStamp = (r.first ? r.second : sampleTimeStamp);
+            }
+            frame = reinterpret_cast<const uint8_t*>(m_sharedMemory->data());
+            if (SNAPSHOT && !CONVERT) {
+                uint8_t *snapshot{m_snapshots->next()};
+                copyFrame(snapshot, frame, m_frameSize);
+                frame = snapshot;
+            }
+        }
+        if (CONVERT) {
+            if (VERBOSE) {
+                converting = cluon::time::now();
+            }
+            convertToI420(m_configuration.format, frame, WIDTH, HEIGHT,
+                          m_pictureIn.img.plane[0], m_pictureIn.img.i_stride[0],
+                          m_pictureIn.img.plane[1], m_pictureIn.img.i_stride[1],
+                          m_pictureIn.img.plane[2], m_pictureIn.img.i_stride[2]);
+            if (VERBOSE) {
+                converted = cluon::time::now();
+            }
+        }
+        else if (SNAPSHOT) {
+            setPlanes(const_cast<uint8_t*>(frame));
+        }
+        if (!RING && (SNAPSHOT || CONVERT)) {
+            if (TIMING) {
+                unlocked = cluon::time::now();
+            }
+            m_sharedMemory->unlock();
+        }
+        // Renditions are scaled from the frame before it is released.
+        if (m_pyramid) {
+            feedRenditions(sampleTimeStamp);
+        }
+        {
+            if (VERBOSE) {
+                before = cluon::time::now();
+            }
+            frameSize = encode(sampleTimeStamp, &nals, &i_nals, &picture_out);
+            if (VERBOSE) {
+                after = cluon::time::now();
+            }
+        }
+        if (!SNAPSHOT && !CONVERT) {
+            if (TIMING) {
+                unlocked = cluon::time::now();
+            }
+            m_sharedMemory->unlock();
+        }
+
+        if (0 < frameSize) {
+            m_lockingMicroseconds = TIMING ? cluon::time::deltaInMicroseconds(unlocked, locked) : 0;
+            publish(nals, i_nals, frameSize, picture_out, sampleTimeStamp);
+
+            if (VERBOSE) {
+                std::clog << m_logPrefix << "Frame size = " << frameSize << " bytes" << (((0 < m_current.maxFrameSize) && (static_cast<uint32_t>(frameSize) > m_current.maxFrameSize)) ? " (above cap)" : "") << "; rate factor = " << picture_out.prop.f_crf_avg << "; sample time = " << cluon::time::toMicroseconds(sampleTimeStamp) << " microseconds; encoding took " << cluon::time::deltaInMicroseconds(after, before) << " microseconds; shared memory locked for " << cluon::time::deltaInMicroseconds(unlocked, locked) << " microseconds";
+                if (CONVERT) {
+                    const int64_t CONVERSION{cluon::time::deltaInMicroseconds(converted, converting)};
+                    std::clog << "; conversion from " << m_configuration.formatName << " took " << CONVERSION << " microseconds (" << (static_cast<double>(CONVERSION) * 1000.0 * 1000.0 / (WIDTH * HEIGHT)) << " microseconds per megapixel)";
+                }
+                if (VFR && (0.0 < m_averageFrameIntervalInMicroseconds)) {
+                    std::clog << "; input frame rate = " << (1000.0 * 1000.0 / m_averageFrameIntervalInMicroseconds) << " fps";
+                }
+                if (RING) {
+                    std::clog << "; skipped frames = " << m_ring->skipped() << "; torn frames = " << m_ring->torn();
+                }
+                std::clog << "." << std::endl;
+            }
+        }
+    }
+    finish();
+}
+
+void EncoderWorker::finish() noexcept {
+    // Without this worker, its renditions would wait forever.
+    for (EncoderWorker *r : m_renditions) {
+        r->stop();
+    }
+    if (m_rebuildThread.joinable()) {
+        m_rebuildThread.join();
+    }
+    if (nullptr != m_nextEncoder) {
+        x264_encoder_close(m_nextEncoder);
+        m_nextEncoder = nullptr;
+    }
+    // The last frames must reach the sending queue and the recorder before
+    // both are shut down.
+    flushDelayedFrames();
+    if (m_sendingThread.joinable()) {
+        // The sending thread empties the queue before it ends.
+        {
+            std::lock_guard<std::mutex> lck(m_queueMutex);
+            m_stopSending = true;
+        }
+        m_queueCondition.notify_one();
+        m_sendingThread.join();
+    }
+    m_running.store(false);
+}
@@ -0,0 +1,406 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENCODER_WORKER_HPP
+#define ENCODER_WORKER_HPP
+
+#include "bitstream-ring.hpp"
+#include "cluon-complete.hpp"
+#include "colorspace-conversion.hpp"
+#include "envelope-sender.hpp"
+#include "frame-buffer-pool.hpp"
+#include "image-scaling.hpp"
+#include "opendlv-video-x264-encoder-message-set.hpp"
+#include "pacer.hpp"
+#include "recorder.hpp"
+#include "rtp-packetizer.hpp"
+#include "shared-memory-ring.hpp"
+#include "spsc-queue.hpp"
+#include "stream-server.hpp"
+
+extern "C" {
+    #include <x264.h>
+}
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Largest payload of a UDP datagram and the bytes reserved for the Envelope
+ * and ImageReading fields around the encoded frame.
+ */
+constexpr uint32_t UDP_PAYLOAD_BUDGET{65507};
+constexpr uint32_t ENVELOPE_OVERHEAD{128};
+
+/**
+ * Rate control modes; PRESET keeps x264's default for the preset (CRF 23).
+ */
+enum class RateControl {
+    PRESET,
+    CRF,
+    ABR,
+    CBR,
+};
+
+/**
+ * Frames dropped first when the queue towards the sending thread is full:
+ * OLDEST drops the oldest frame, NON_REFERENCE drops the oldest frame that
+ * no other frame refers to before falling back to the oldest frame.
+ */
+enum class DropPolicy {
+    OLDEST,
+    NON_REFERENCE,
+};
+
+/**
+ * Settings for encoding the frames from one shared memory area.
+ */
+struct EncoderWorkerConfiguration {
+    std::string name{""};
+    uint32_t width{0};
+    uint32_t height{0};
+    uint32_t id{0};
+    uint16_t cid{0};
+    uint32_t gop{10};
+    bool intraRefresh{false};
+    bool lossRecovery{false};  // answer ImageLossReport by invalidating references
+    std::string preset{"veryfast"};
+    std::string formatName{"i420"};
+    PixelFormat format{PixelFormat::I420};
+    uint32_t fps{20};
+    uint32_t threads{1};
+    bool slicedThreads{true};
+    RateControl rateControl{RateControl::PRESET};
+    float crf{23.0f};
+    uint32_t bitrate{0};       // kbit/s
+    uint32_t vbvMaxrate{0};    // kbit/s
+    uint32_t vbvBufsize{0};    // kbit
+    uint32_t maxFrameSize{UDP_PAYLOAD_BUDGET - ENVELOPE_OVERHEAD}; // bytes
+    uint32_t sliceMaxSize{0};  // bytes; 0 publishes whole frames
+    uint32_t fragmentSize{UDP_PAYLOAD_BUDGET - ENVELOPE_OVERHEAD}; // bytes; larger frames are fragmented
+    uint32_t fec{0};           // repair datagrams in percent of the fragments of a frame
+    uint32_t minKeyframeInterval{1000}; // ms between forced keyframes
+    uint32_t queueSize{0};     // frames; 0 publishes on the encoding thread
+    DropPolicy dropPolicy{DropPolicy::OLDEST};
+    std::string outputRing{""};  // name of the shared memory area for the encoded frames
+    uint32_t outputRingSize{0};  // bytes
+    std::string record{""};      // .rec or .h264 file to record to
+    uint64_t recordMaxSize{0};   // bytes per file; 0 = no rotation by size
+    uint32_t recordMaxDuration{0}; // s per file; 0 = no rotation by time
+    std::string rtpAddress{""};  // unicast or multicast destination of RTP packets
+    uint16_t rtpPort{0};
+    uint32_t mtu{1500};          // bytes of the network for RTP packets and segmentation offload
+    RtpPacketizationMode rtpMode{RtpPacketizationMode::NON_INTERLEAVED};
+    uint32_t pacing{0};          // percent of the frame interval to spread datagrams over; 0 = no pacing
+    uint32_t pacingBurst{8192};  // bytes sent back to back
+    bool pacingKernel{false};    // pace with SO_TXTIME or SO_MAX_PACING_RATE
+    bool snapshot{false};
+    bool ring{false};
+    bool vfr{false};
+    bool zeroCopy{false};
+    bool batch{false};
+    bool frameInfo{false};       // send opendlv::proxy::ImageEncoderFrameInfo after every frame
+    bool verbose{false};
+    // Encodes frames scaled by another worker instead of reading name.
+    bool rendition{false};
+};
+
+/**
+ * Counters of one worker since it was started.
+ */
+struct EncoderWorkerStatistics {
+    uint64_t frames{0};
+    uint64_t bytes{0};
+    double bytesSquaredSum{0.0};
+    uint64_t peakFrameSize{0};
+    uint64_t framesAboveCap{0};   // frames larger than maxFrameSize
+    uint64_t framesNearCap{0};    // frames within 10% below maxFrameSize
+    double rateFactorSum{0.0};
+    double rateFactorSumNearCap{0.0};
+    uint64_t keyframeRequests{0};
+    uint64_t forcedKeyframes{0};
+    uint64_t lossReports{0};
+    uint64_t invalidations{0};    // loss reports answered without a keyframe
+    uint64_t recoveryFrames{0};   // first frames encoded after a loss report
+    uint64_t recoveryBytes{0};
+    uint64_t recoveryMicroseconds{0}; // from the loss report to publishing the recovery frame
+    uint64_t fragmentedFrames{0}; // frames sent as ImageReadingFragment
+    uint64_t repairDatagrams{0};  // ImageReadingRepair sent for fragmented frames
+    uint64_t repairMicroseconds{0};
+    uint64_t unprotectedFrames{0}; // fragmented frames with too many fragments for repairs
+    uint64_t publishingMicroseconds{0};
+    uint64_t datagrams{0};
+    uint64_t systemCalls{0};      // calls to send datagrams
+    uint32_t queueDepth{0};       // frames waiting for the sending thread
+    uint32_t peakQueueDepth{0};
+    uint64_t droppedFrames{0};    // frames dropped from the queue
+    uint64_t droppedReferenceFrames{0};
+    uint64_t outputRingFrames{0}; // frames published into outputRing
+    uint64_t outputRingMicroseconds{0};
+    uint64_t outputRingOversized{0}; // frames too large for outputRing
+    uint64_t recordedBytes{0};
+    uint64_t recordDroppedFrames{0}; // frames not recorded as the disk was too slow
+    uint32_t recordFiles{0};
+    uint64_t rtpPackets{0};
+    uint64_t rtpOversized{0};     // NAL units too large for an RTP packet
+    uint64_t encodingMicroseconds{0}; // time spent in x264_encoder_encode
+    uint64_t scalingMicroseconds{0};  // time spent scaling renditions
+    uint64_t skippedFrames{0};    // frames a rendition was still busy for
+    uint64_t pacedDatagrams{0};
+    uint64_t pacingDelayMicroseconds{0}; // time paced datagrams waited for departure
+    uint64_t pacingPeakDelayMicroseconds{0};
+    uint64_t pacingPeakBurst{0};  // bytes sent back to back
+    uint64_t pacingDropped{0};    // paced datagrams that the kernel did not send
+};
+
+/**
+ * One encoded frame on its way from the encoding to the sending thread.
+ */
+struct EncodedFrame {
+    std::vector<uint8_t> data{};
+    std::vector<uint32_t> nalSizes{};
+    cluon::data::TimeStamp sampleTimeStamp{};
+    bool reference{false};
+    bool dropped{false};
+    opendlv::proxy::ImageEncoderFrameInfo info{};
+};
+
+/**
+ * This class attaches to one shared memory area, encodes every notified frame
+ * with its own x264 instance on its own thread, and publishes the result as
+ * opendlv::proxy::ImageReading to the given OD4Session, which may be shared
+ * among several workers; without OD4Session, the worker publishes through
+ * its own EnvelopeSender.
+ */
+class EncoderWorker {
+   private:
+    EncoderWorker(const EncoderWorker &) = delete;
+    EncoderWorker(EncoderWorker &&)      = delete;
+    EncoderWorker &operator=(const EncoderWorker &) = delete;
+    EncoderWorker &operator=(EncoderWorker &&) = delete;
+
+   public:
+    /**
+     * @param od4 OD4Session to publish to or nullptr to only send to the
+     *            OD4Session given by configuration.cid.
+     */
+    EncoderWorker(const EncoderWorkerConfiguration &configuration, cluon::OD4Session *od4) noexcept;
+    ~EncoderWorker() noexcept;
+
+    /**
+     * This method attaches to the shared memory area and opens the encoder.
+     *
+     * @return true on success; the reason for a failure is printed to std::cerr.
+     */
+    bool open() noexcept;
+
+    /**
+     * This method starts the encoding thread.
+     */
+    void start() noexcept;
+
+    /**
+     * This method stops and joins the encoding thread.
+     */
+    void stop() noexcept;
+
+    /**
+     * @return true while the encoding thread is running.
+     */
+    bool isRunning() const noexcept;
+
+    const EncoderWorkerConfiguration &configuration() const noexcept;
+
+    /**
+     * @return Counters since the worker was started.
+     */
+    EncoderWorkerStatistics statistics() const noexcept;
+
+    /**
+     * This method queues changed settings that the encoding thread applies
+     * before the next frame; it may be called from any thread.
+     */
+    void control(const opendlv::proxy::ImageEncoderControl &control) noexcept;
+
+    /**
+     * This method asks for a keyframe, which is forced on the next frame
+     * unless the last forced keyframe is more recent than
+     * minKeyframeInterval; it may be called from any thread.
+     */
+    void requestKeyframe() noexcept;
+
+    /**
+     * This method makes the next frame refer only to frames before the lost
+     * one with x264_encoder_invalidate_reference; if the lost frame is
+     * unknown or x264 cannot invalidate it, e.g., with --intra-refresh, a
+     * keyframe is requested instead. It may be called from any thread.
+     */
+    void reportLoss(const opendlv::proxy::ImageLossReport &report) noexcept;
+
+    /**
+     * This method adds a StreamServer that receives every encoded frame as
+     * one ImageReading regardless of slicing and fragmentation; it must be
+     * called before start() and the server must outlive the worker.
+     */
+    void addStreamServer(StreamServer *server) noexcept;
+
+    /**
+     * This method adds a worker with configuration.rendition that encodes
+     * every frame of this worker at its own size; it must be called before
+     * open() and the rendition must outlive this worker.
+     */
+    void addRendition(EncoderWorker *rendition) noexcept;
+
+   private:
+    void run() noexcept;
+    void runRendition() noexcept;
+    void finish() noexcept;
+    int encode(const cluon::data::TimeStamp &sampleTimeStamp, x264_nal_t **nals, int *i_nals, x264_picture_t *pictureOut) noexcept;
+    void feedRenditions(const cluon::data::TimeStamp &sampleTimeStamp) noexcept;
+    void receive(const ScalingPyramid &pyramid, const cluon::data::TimeStamp &sampleTimeStamp) noexcept;
+    void setPlanes(uint8_t *frame) noexcept;
+    bool makeParameters(const EncoderWorkerConfiguration &configuration, x264_param_t &parameters) const noexcept;
+    void printParameters() const noexcept;
+    void applyControl() noexcept;
+    void applyLossReport() noexcept;
+    void swapEncoder() noexcept;
+    void flushDelayedFrames() noexcept;
+    void publishToOutputRing(const uint8_t *data, uint32_t size, const x264_picture_t &pictureOut, const cluon::data::TimeStamp &sampleTimeStamp) noexcept;
+    void publish(x264_nal_t *nals, int i_nals, int frameSize, const x264_picture_t &pictureOut, cluon::data::TimeStamp &sampleTimeStamp) noexcept;
+    void send(const uint8_t *data, uint32_t size, const std::vector<uint32_t> &nalSizes, const cluon::data::TimeStamp &sampleTimeStamp, opendlv::proxy::ImageEncoderFrameInfo &info) noexcept;
+    void sendQueuedFrames() noexcept;
+    template <typename T>
+    void sendMessage(T &message, const cluon::data::TimeStamp &sampleTimeStamp) noexcept {
+        if (m_configuration.batch || m_pacer) {
+            m_datagrams.push_back(EnvelopeSender::serialize(message, sampleTimeStamp, m_configuration.id));
+        }
+        else if (nullptr != m_od4) {
+            m_od4->send(message, sampleTimeStamp, m_configuration.id);
+            m_datagramsViaOD4++;
+        }
+        else {
+            m_envelopeSender->send(message, sampleTimeStamp, m_configuration.id);
+        }
+    }
+    void sendBatch() noexcept;
+    void publishSlices(const uint8_t *data, const std::vector<uint32_t> &nalSizes, const cluon::data::TimeStamp &sampleTimeStamp) noexcept;
+    void publishFragments(const uint8_t *data, uint32_t size, const cluon::data::TimeStamp &sampleTimeStamp) noexcept;
+
+   private:
+    const EncoderWorkerConfiguration m_configuration;
+    cluon::OD4Session *m_od4;
+    const std::string m_logPrefix;
+
+    std::unique_ptr<cluon::SharedMemory> m_sharedMemory{nullptr};
+    std::unique_ptr<FrameBufferPool> m_snapshots{nullptr};
+    std::unique_ptr<SharedMemoryRingReader> m_ring{nullptr};
+    std::unique_ptr<cluon::SharedMemory> m_outputSharedMemory{nullptr};
+    std::unique_ptr<BitstreamRingWriter> m_outputRing{nullptr};
+    std::unique_ptr<Recorder> m_recorder{nullptr};
+    std::unique_ptr<RtpPacketizer> m_rtpPacketizer{nullptr};
+    std::unique_ptr<EnvelopeSender> m_rtpSender{nullptr};
+    std::vector<std::string> m_rtpPackets{};
+    std::unique_ptr<Pacer> m_rtpPacer{nullptr};
+    std::unique_ptr<EnvelopeSender> m_envelopeSender{nullptr};
+    std::unique_ptr<Pacer> m_pacer{nullptr};
+    std::vector<StreamServer*> m_streamServers{};
+    uint32_t m_frameSize{0};
+    bool m_convert{false};
+
+    x264_param_t m_parameters{};
+    x264_picture_t m_pictureIn{};
+    bool m_pictureAllocated{false};
+    x264_t *m_encoder{nullptr};
+    // Sample time stamps of pictures still inside x264 when frame threads delay the output.
+    std::deque<std::pair<int64_t, cluon::data::TimeStamp>> m_pendingSampleTimeStamps{};
+    int64_t m_frameCounter{0};
+    int64_t m_lastPts{0};
+    double m_averageFrameIntervalInMicroseconds{0.0};
+    // Durations of the last x264_encoder_encode call and shared memory lock.
+    int64_t m_encodingMicroseconds{0};
+    int64_t m_lockingMicroseconds{0};
+    uint32_t m_frameId{0};
+
+    // Settings of the running encoder, which differ from m_configuration
+    // after a control message; only used by the encoding thread.
+    EncoderWorkerConfiguration m_current{};
+    std::mutex m_controlMutex{};
+    bool m_hasControl{false};
+    opendlv::proxy::ImageEncoderControl m_control{};
+    // Replacement encoder opened in the background.
+    std::thread m_rebuildThread{};
+    std::atomic<bool> m_rebuildDone{false};
+    EncoderWorkerConfiguration m_next{};
+    x264_param_t m_nextParameters{};
+    x264_t *m_nextEncoder{nullptr};
+
+    // Datagrams of the current frame in batch mode.
+    std::vector<std::string> m_datagrams{};
+    uint64_t m_datagramsViaOD4{0};
+    // Sizes of the NAL units of the current frame when sending directly.
+    std::vector<uint32_t> m_nalSizes{};
+    // Encoded frames waiting for the sending thread.
+    std::unique_ptr<SpscQueue<EncodedFrame>> m_queue{nullptr};
+    std::mutex m_queueMutex{};
+    std::condition_variable m_queueCondition{};
+    bool m_stopSending{false};
+    std::thread m_sendingThread{};
+
+    // Renditions fed by this worker and the levels they are scaled from.
+    std::vector<EncoderWorker*> m_renditions{};
+    std::unique_ptr<ScalingPyramid> m_pyramid{nullptr};
+    // Hand-over of the scaled picture when this worker is a rendition.
+    enum class InputState {
+        EMPTY,
+        WRITING,
+        FILLED,
+        ENCODING,
+    };
+    std::mutex m_inputMutex{};
+    std::condition_variable m_inputCondition{};
+    InputState m_inputState{InputState::EMPTY};
+    cluon::data::TimeStamp m_inputSampleTimeStamp{};
+
+    std::atomic<bool> m_keyframeRequested{false};
+    std::chrono::steady_clock::time_point m_lastForcedKeyframe{};
+
+    std::mutex m_lossMutex{};
+    bool m_hasLossReport{false};
+    opendlv::proxy::ImageLossReport m_lossReport{};
+    std::chrono::steady_clock::time_point m_lossReported{};
+    // pts and sampleTimeStamp in microseconds of the recently published
+    // frames, oldest first, to find the lost frame of a report.
+    std::deque<std::pair<int64_t, int64_t>> m_publishedPts{};
+    bool m_recovering{false};
+    std::chrono::steady_clock::time_point m_recoveryStarted{};
+
+    std::atomic<bool> m_running{false};
+    std::atomic<bool> m_stop{false};
+    std::thread m_thread{};
+
+    mutable std::mutex m_statisticsMutex{};
+    EncoderWorkerStatistics m_statistics{};
+};
+
+#endif
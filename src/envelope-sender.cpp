@@ -0,0 +1,456 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "envelope-sender.hpp"
+#include "opendlv-standard-message-set.hpp"
+
+#include <arpa/inet.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+
+// Older C libraries do not know UDP generic segmentation offload (Linux 4.18).
+#ifndef SOL_UDP
+    #define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+    #define UDP_SEGMENT 103
+#endif
+// Departure times per datagram (Linux 4.19) and per socket (Linux 3.13).
+#ifndef SO_TXTIME
+    #define SO_TXTIME 61
+    #define SCM_TXTIME SO_TXTIME
+#endif
+#ifndef SO_MAX_PACING_RATE
+    #define SO_MAX_PACING_RATE 47
+#endif
+#ifndef SO_EE_ORIGIN_TXTIME
+    #define SO_EE_ORIGIN_TXTIME 6
+#endif
+static constexpr uint32_t SOF_TXTIME_REPORT_ERRORS_FLAG{1u << 1};
+
+// Layout of struct sock_txtime from linux/net_tstamp.h.
+struct SocketTxTime {
+    clockid_t clockid;
+    uint32_t flags;
+};
+
+// Protobuf wire types as used by cluon::ToProtoVisitor.
+static constexpr uint8_t VARINT{0};
+static constexpr uint8_t LENGTH_DELIMITED{2};
+
+static uint8_t *putVarInt(uint8_t *dst, uint64_t v) noexcept {
+    while (0x7f < v) {
+        *dst++ = static_cast<uint8_t>((v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    *dst++ = static_cast<uint8_t>(v);
+    return dst;
+}
+
+static uint32_t sizeOfVarInt(uint64_t v) noexcept {
+    uint32_t size{1};
+    for (; 0x7f < v; v >>= 7) {
+        size++;
+    }
+    return size;
+}
+
+static uint8_t *putKey(uint8_t *dst, uint32_t fieldIdentifier, uint8_t wireType) noexcept {
+    return putVarInt(dst, (fieldIdentifier << 3) | wireType);
+}
+
+static uint64_t zigZag(int32_t v) noexcept {
+    return static_cast<uint32_t>((static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31));
+}
+
+// cluon::data::TimeStamp as nested field of the Envelope.
+static uint8_t *putTimeStamp(uint8_t *dst, uint32_t fieldIdentifier, const cluon::data::TimeStamp &ts) noexcept {
+    const uint64_t SECONDS{zigZag(ts.seconds())};
+    const uint64_t MICROSECONDS{zigZag(ts.microseconds())};
+    dst = putKey(dst, fieldIdentifier, LENGTH_DELIMITED);
+    dst = putVarInt(dst, 2 + sizeOfVarInt(SECONDS) + sizeOfVarInt(MICROSECONDS));
+    dst = putKey(dst, 1, VARINT);
+    dst = putVarInt(dst, SECONDS);
+    dst = putKey(dst, 2, VARINT);
+    return putVarInt(dst, MICROSECONDS);
+}
+
+EnvelopeSender::EnvelopeSender(uint16_t cid) noexcept
+    : EnvelopeSender("225.0.0." + std::to_string(cid), 12175) {}
+
+EnvelopeSender::EnvelopeSender(const std::string &address, uint16_t port) noexcept {
+    std::memset(&m_address, 0, sizeof(m_address));
+    m_address.sin_family = AF_INET;
+    m_address.sin_port = htons(port);
+    if (1 == ::inet_pton(AF_INET, address.c_str(), &m_address.sin_addr)) {
+        m_socket = ::socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    }
+}
+
+EnvelopeSender::~EnvelopeSender() noexcept {
+    if (!(m_socket < 0)) {
+        ::close(m_socket);
+    }
+}
+
+bool EnvelopeSender::valid() const noexcept {
+    return !(m_socket < 0);
+}
+
+uint64_t EnvelopeSender::systemCalls() const noexcept {
+    return m_systemCalls;
+}
+
+uint64_t EnvelopeSender::datagrams() const noexcept {
+    return m_datagrams;
+}
+
+bool EnvelopeSender::sendDatagram(const std::string &datagram) noexcept {
+    constexpr std::size_t MAX_DATAGRAM{65507};
+    if ( (m_socket < 0) || (datagram.size() > MAX_DATAGRAM) ) {
+        return false;
+    }
+    m_systemCalls++;
+    const ssize_t SENT_BYTES{::sendto(m_socket, datagram.data(), datagram.size(), 0, reinterpret_cast<const struct sockaddr*>(&m_address), sizeof(m_address))};
+    const bool SENT{SENT_BYTES == static_cast<ssize_t>(datagram.size())};
+    m_datagrams += (SENT ? 1 : 0);
+    return SENT;
+}
+
+std::size_t EnvelopeSender::sendBatch(const std::vector<std::string> &datagrams) noexcept {
+    std::size_t sent{0};
+    std::size_t next{0};
+    bool segment{m_segmentationOffload};
+    while (next < datagrams.size()) {
+        std::size_t n{0};
+        if (segment) {
+            bool rejected{false};
+            n = sendSegmented(datagrams, next, rejected);
+            segment = m_segmentationOffload && !rejected;
+        }
+        if ( (0 == n) && m_sendMultiple ) {
+            n = sendMultiple(datagrams, next, datagrams.size(), nullptr);
+        }
+        if (0 == n) {
+            // Datagrams that cannot be sent at all are skipped.
+            sent += (sendDatagram(datagrams[next]) ? 1 : 0);
+            next++;
+        }
+        else {
+            sent += n;
+            next += n;
+        }
+    }
+    return sent;
+}
+
+void EnvelopeSender::setMtu(uint32_t mtu) noexcept {
+    constexpr uint32_t IP_AND_UDP_HEADERS{20 + 8};
+    m_maxSegmentSize = (mtu > IP_AND_UDP_HEADERS) ? (mtu - IP_AND_UDP_HEADERS) : 0;
+}
+
+std::size_t EnvelopeSender::sendSegmented(const std::vector<std::string> &datagrams, std::size_t first, bool &rejected) noexcept {
+    // The kernel cuts the payload into segments of the size of the first
+    // datagram; only the last one may be shorter. One send is limited to
+    // UDP_MAX_SEGMENTS (64) segments and the size of one UDP datagram, and
+    // segments must not exceed the MTU as the kernel does not fragment them.
+    constexpr std::size_t MAX_SEGMENTS{64};
+    constexpr std::size_t MAX_TOTAL{65507};
+    const std::size_t SEGMENT_SIZE{datagrams[first].size()};
+    if (SEGMENT_SIZE > m_maxSegmentSize) {
+        return 0;
+    }
+    std::size_t last{first};
+    std::size_t total{SEGMENT_SIZE};
+    while ( ((last + 1) < datagrams.size()) && ((last + 1 - first) < MAX_SEGMENTS)
+            && ((total + datagrams[last + 1].size()) <= MAX_TOTAL)
+            && (datagrams[last].size() == SEGMENT_SIZE) && (datagrams[last + 1].size() <= SEGMENT_SIZE) ) {
+        last++;
+        total += datagrams[last].size();
+    }
+    const std::size_t COUNT{last - first + 1};
+    if ( (m_socket < 0) || (2 > COUNT) ) {
+        return 0;
+    }
+
+    m_iovecs.resize(COUNT);
+    for (std::size_t i{0}; i < COUNT; i++) {
+        m_iovecs[i].iov_base = const_cast<char*>(datagrams[first + i].data());
+        m_iovecs[i].iov_len = datagrams[first + i].size();
+    }
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    std::memset(control, 0, sizeof(control));
+    struct msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_name = &m_address;
+    message.msg_namelen = sizeof(m_address);
+    message.msg_iov = m_iovecs.data();
+    message.msg_iovlen = COUNT;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    struct cmsghdr *cm{CMSG_FIRSTHDR(&message)};
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    const uint16_t GSO_SIZE{static_cast<uint16_t>(SEGMENT_SIZE)};
+    std::memcpy(CMSG_DATA(cm), &GSO_SIZE, sizeof(GSO_SIZE));
+
+    m_systemCalls++;
+    if (static_cast<ssize_t>(total) != ::sendmsg(m_socket, &message, 0)) {
+        // Kernels before 4.18 and devices without checksum offload reject
+        // segmentation offload; these errors do not go away. Others, such as
+        // EINVAL for a path MTU below the segment size, only concern this send.
+        if ( (EIO == errno) || (ENOPROTOOPT == errno) || (EOPNOTSUPP == errno) ) {
+            m_segmentationOffload = false;
+        }
+        rejected = true;
+        return 0;
+    }
+    m_datagrams += COUNT;
+    return COUNT;
+}
+
+std::size_t EnvelopeSender::sendMultiple(const std::vector<std::string> &datagrams, std::size_t first, std::size_t last, const int64_t *departures) noexcept {
+    constexpr std::size_t MAX_MESSAGES{64};
+    const std::size_t COUNT{std::min(MAX_MESSAGES, last - first)};
+    if (m_socket < 0) {
+        return 0;
+    }
+
+    constexpr std::size_t CONTROL_SIZE{CMSG_SPACE(sizeof(uint64_t))};
+    constexpr std::size_t CONTROL_WORDS{(CONTROL_SIZE + sizeof(uint64_t) - 1) / sizeof(uint64_t)};
+    m_iovecs.resize(COUNT);
+    m_messages.resize(COUNT);
+    if (nullptr != departures) {
+        m_controls.assign(COUNT * CONTROL_WORDS, 0);
+    }
+    for (std::size_t i{0}; i < COUNT; i++) {
+        m_iovecs[i].iov_base = const_cast<char*>(datagrams[first + i].data());
+        m_iovecs[i].iov_len = datagrams[first + i].size();
+        std::memset(&m_messages[i], 0, sizeof(struct mmsghdr));
+        m_messages[i].msg_hdr.msg_name = &m_address;
+        m_messages[i].msg_hdr.msg_namelen = sizeof(m_address);
+        m_messages[i].msg_hdr.msg_iov = &m_iovecs[i];
+        m_messages[i].msg_hdr.msg_iovlen = 1;
+        if (nullptr != departures) {
+            m_messages[i].msg_hdr.msg_control = &m_controls[i * CONTROL_WORDS];
+            m_messages[i].msg_hdr.msg_controllen = CONTROL_SIZE;
+            struct cmsghdr *cm{CMSG_FIRSTHDR(&m_messages[i].msg_hdr)};
+            cm->cmsg_level = SOL_SOCKET;
+            cm->cmsg_type = SCM_TXTIME;
+            cm->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+            const uint64_t DEPARTURE{static_cast<uint64_t>(departures[i])};
+            std::memcpy(CMSG_DATA(cm), &DEPARTURE, sizeof(DEPARTURE));
+        }
+    }
+
+    m_systemCalls++;
+    const int SENT{::sendmmsg(m_socket, m_messages.data(), static_cast<unsigned int>(COUNT), 0)};
+    if (0 > SENT) {
+        if (ENOSYS == errno) {
+            m_sendMultiple = false;
+        }
+        return 0;
+    }
+    m_datagrams += static_cast<uint64_t>(SENT);
+    return static_cast<std::size_t>(SENT);
+}
+
+PacingMode EnvelopeSender::enablePacing(bool kernel) noexcept {
+    m_pacingMode = PacingMode::USER_SPACE;
+    if (kernel && !(m_socket < 0)) {
+        // The fq queue discipline expects CLOCK_MONOTONIC; etf reports
+        // datagrams that missed their departure time on the error queue.
+        SocketTxTime txTime{CLOCK_MONOTONIC, SOF_TXTIME_REPORT_ERRORS_FLAG};
+        const uint32_t UNLIMITED{~0u};
+        if (0 == ::setsockopt(m_socket, SOL_SOCKET, SO_TXTIME, &txTime, sizeof(txTime))) {
+            m_pacingMode = PacingMode::TXTIME;
+        }
+        else if (0 == ::setsockopt(m_socket, SOL_SOCKET, SO_MAX_PACING_RATE, &UNLIMITED, sizeof(UNLIMITED))) {
+            m_pacingMode = PacingMode::MAX_PACING_RATE;
+        }
+    }
+    return m_pacingMode;
+}
+
+uint64_t EnvelopeSender::droppedByKernel() noexcept {
+    uint64_t dropped{0};
+    char control[256];
+    while (true) {
+        char data[1];
+        struct iovec part{data, sizeof(data)};
+        struct msghdr message;
+        std::memset(&message, 0, sizeof(message));
+        message.msg_iov = &part;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if (0 > ::recvmsg(m_socket, &message, MSG_ERRQUEUE | MSG_DONTWAIT)) {
+            break;
+        }
+        for (struct cmsghdr *cm{CMSG_FIRSTHDR(&message)}; nullptr != cm; cm = CMSG_NXTHDR(&message, cm)) {
+            struct sock_extended_err error;
+            if (CMSG_LEN(sizeof(error)) <= cm->cmsg_len) {
+                std::memcpy(&error, CMSG_DATA(cm), sizeof(error));
+                dropped += (SO_EE_ORIGIN_TXTIME == error.ee_origin) ? 1 : 0;
+            }
+        }
+    }
+    return dropped;
+}
+
+std::size_t EnvelopeSender::sendPaced(const std::vector<std::string> &datagrams, Pacer &pacer) noexcept {
+    const int64_t NOW{Pacer::now()};
+    m_departures.resize(datagrams.size());
+    for (std::size_t i{0}; i < datagrams.size(); i++) {
+        m_departures[i] = pacer.departure(static_cast<uint32_t>(datagrams[i].size()), NOW);
+    }
+    if ( (PacingMode::MAX_PACING_RATE == m_pacingMode) && (pacer.rate() != m_pacingRate) ) {
+        // The option takes 32 bits on older kernels.
+        const uint32_t RATE{static_cast<uint32_t>(std::min<uint64_t>(pacer.rate(), ~0u))};
+        if (0 == ::setsockopt(m_socket, SOL_SOCKET, SO_MAX_PACING_RATE, &RATE, sizeof(RATE))) {
+            m_pacingRate = pacer.rate();
+        }
+    }
+
+    std::size_t sent{0};
+    std::size_t next{0};
+    while (next < datagrams.size()) {
+        // In user space, datagrams with the same departure time are sent
+        // together; the kernel takes all datagrams at once.
+        std::size_t last{next + 1};
+        if (PacingMode::USER_SPACE == m_pacingMode) {
+            while ( (last < datagrams.size()) && (m_departures[last] == m_departures[next]) ) {
+                last++;
+            }
+            if (m_departures[next] > Pacer::now()) {
+                struct timespec departure{};
+                departure.tv_sec = static_cast<time_t>(m_departures[next] / (1000 * 1000 * 1000));
+                departure.tv_nsec = static_cast<long>(m_departures[next] % (1000 * 1000 * 1000));
+                while (EINTR == ::clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &departure, nullptr)) {}
+            }
+        }
+        else {
+            last = datagrams.size();
+        }
+
+        while (next < last) {
+            const std::size_t N{m_sendMultiple ? sendMultiple(datagrams, next, last, (PacingMode::TXTIME == m_pacingMode) ? &m_departures[next] : nullptr) : 0};
+            if (0 == N) {
+                const bool SENT{sendDatagram(datagrams[next])};
+                sent += (SENT ? 1 : 0);
+                pacer.dropped(SENT ? 0 : 1);
+                next++;
+            }
+            else {
+                sent += N;
+                next += N;
+            }
+        }
+    }
+    if (PacingMode::TXTIME == m_pacingMode) {
+        pacer.dropped(droppedByKernel());
+    }
+    return sent;
+}
+
+bool EnvelopeSender::sendImageReading(const uint8_t *data, uint32_t size, uint32_t width, uint32_t height,
+                                      const cluon::data::TimeStamp &sampleTimeStamp, uint32_t senderStamp) noexcept {
+    if (m_socket < 0) {
+        return false;
+    }
+
+    // Trailer: sent, received (unset), sampleTimeStamp, and senderStamp; like
+    // OD4Session::send, an unset sample time stamp is replaced by sent.
+    const cluon::data::TimeStamp SENT{cluon::time::now()};
+    const bool HAS_SAMPLE_TIME{0 != (sampleTimeStamp.seconds() + sampleTimeStamp.microseconds())};
+    uint8_t *t{m_trailer.data()};
+    t = putTimeStamp(t, 3, SENT);
+    t = putTimeStamp(t, 4, cluon::data::TimeStamp{});
+    t = putTimeStamp(t, 5, HAS_SAMPLE_TIME ? sampleTimeStamp : SENT);
+    t = putKey(t, 6, VARINT);
+    t = putVarInt(t, senderStamp);
+    const uint32_t TRAILER_SIZE{static_cast<uint32_t>(t - m_trailer.data())};
+
+    // ImageReading: fourcc, width, height, and data, whose bytes follow the header.
+    const char FOURCC[]{"h264"};
+    const uint32_t FOURCC_SIZE{sizeof(FOURCC) - 1};
+    const uint32_t IMAGE_READING_SIZE{(1 + sizeOfVarInt(FOURCC_SIZE) + FOURCC_SIZE)
+                                      + (1 + sizeOfVarInt(width))
+                                      + (1 + sizeOfVarInt(height))
+                                      + (1 + sizeOfVarInt(size) + size)};
+    const int32_t DATA_TYPE{static_cast<int32_t>(opendlv::proxy::ImageReading::ID())};
+    const uint32_t ENVELOPE_SIZE{(1 + sizeOfVarInt(zigZag(DATA_TYPE)))
+                                 + (1 + sizeOfVarInt(IMAGE_READING_SIZE) + IMAGE_READING_SIZE)
+                                 + TRAILER_SIZE};
+    // The OD4 header stores the length in three bytes.
+    constexpr uint32_t MAX_DATAGRAM{65507};
+    constexpr uint32_t OD4_HEADER_SIZE{5};
+    if ( (ENVELOPE_SIZE > 0xFFFFFF) || (OD4_HEADER_SIZE + ENVELOPE_SIZE > MAX_DATAGRAM) ) {
+        return false;
+    }
+
+    uint8_t *h{m_header.data()};
+    *h++ = 0x0D;
+    *h++ = 0xA4;
+    *h++ = static_cast<uint8_t>(ENVELOPE_SIZE & 0xFF);
+    *h++ = static_cast<uint8_t>((ENVELOPE_SIZE >> 8) & 0xFF);
+    *h++ = static_cast<uint8_t>((ENVELOPE_SIZE >> 16) & 0xFF);
+    h = putKey(h, 1, VARINT);
+    h = putVarInt(h, zigZag(DATA_TYPE));
+    h = putKey(h, 2, LENGTH_DELIMITED);
+    h = putVarInt(h, IMAGE_READING_SIZE);
+    h = putKey(h, 1, LENGTH_DELIMITED);
+    h = putVarInt(h, FOURCC_SIZE);
+    std::memcpy(h, FOURCC, FOURCC_SIZE);
+    h += FOURCC_SIZE;
+    h = putKey(h, 2, VARINT);
+    h = putVarInt(h, width);
+    h = putKey(h, 3, VARINT);
+    h = putVarInt(h, height);
+    h = putKey(h, 4, LENGTH_DELIMITED);
+    h = putVarInt(h, size);
+
+    struct iovec parts[3];
+    parts[0].iov_base = m_header.data();
+    parts[0].iov_len = static_cast<std::size_t>(h - m_header.data());
+    parts[1].iov_base = const_cast<uint8_t*>(data);
+    parts[1].iov_len = size;
+    parts[2].iov_base = m_trailer.data();
+    parts[2].iov_len = TRAILER_SIZE;
+
+    struct msghdr message;
+    std::memset(&message, 0, sizeof(message));
+    message.msg_name = &m_address;
+    message.msg_namelen = sizeof(m_address);
+    message.msg_iov = parts;
+    message.msg_iovlen = 3;
+    m_systemCalls++;
+    const ssize_t SENT_BYTES{::sendmsg(m_socket, &message, 0)};
+    const bool COMPLETE{SENT_BYTES == static_cast<ssize_t>(parts[0].iov_len + parts[1].iov_len + parts[2].iov_len)};
+    m_datagrams += (COMPLETE ? 1 : 0);
+    return COMPLETE;
+}
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ENVELOPE_SENDER_HPP
+#define ENVELOPE_SENDER_HPP
+
+#include "cluon-complete.hpp"
+#include "pacer.hpp"
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * This class publishes messages into an OD4Session without joining it, i.e.,
+ * without the receiving thread of cluon::OD4Session; the Envelopes are
+ * identical to the ones sent by cluon::OD4Session::send.
+ *
+ * opendlv::proxy::ImageReading can also be sent without copying the frame:
+ * only the fields around the frame are encoded into small buffers that are
+ * reused for every frame, and header, frame, and trailer are handed to the
+ * kernel with one scatter-gather sendmsg call.
+ *
+ * The datagrams of a sliced or fragmented frame can be sent as one batch:
+ * with UDP generic segmentation offload (UDP_SEGMENT), the kernel splits one
+ * large send into datagrams of equal size; otherwise, all datagrams are
+ * passed to one sendmmsg call. Segmentation offload is only tried for
+ * datagrams that fit into the MTU given to setMtu(); a send that the kernel
+ * rejects otherwise, e.g., with EINVAL for a path with a smaller MTU, falls
+ * back to sendmmsg for the rest of that batch only. Kernels without
+ * UDP_SEGMENT or sendmmsg are detected at the first failing call and the next
+ * method is used from then on.
+ *
+ * Paced datagrams are sent without segmentation offload as the kernel would
+ * send all segments of one send at once; depending on enablePacing(), their
+ * departure times are passed to the kernel or awaited before sending.
+ *
+ * The class is not thread-safe; every encoding thread uses its own instance.
+ */
+class EnvelopeSender {
+   private:
+    EnvelopeSender(const EnvelopeSender &) = delete;
+    EnvelopeSender(EnvelopeSender &&)      = delete;
+    EnvelopeSender &operator=(const EnvelopeSender &) = delete;
+    EnvelopeSender &operator=(EnvelopeSender &&) = delete;
+
+   public:
+    /**
+     * @param cid OD4Session to send to (multicast group 225.0.0.cid, port 12175).
+     */
+    explicit EnvelopeSender(uint16_t cid) noexcept;
+
+    /**
+     * @param address IPv4 address to send datagrams from sendBatch() to,
+     *                e.g., for RTP; unicast or multicast.
+     * @param port UDP port to send to.
+     */
+    EnvelopeSender(const std::string &address, uint16_t port) noexcept;
+    ~EnvelopeSender() noexcept;
+
+    /**
+     * @return true if the socket could be created.
+     */
+    bool valid() const noexcept;
+
+    /**
+     * This method sends the given message like cluon::OD4Session::send.
+     *
+     * @return false if the Envelope does not fit into a datagram or sending failed.
+     */
+    template <typename T>
+    bool send(T &message, const cluon::data::TimeStamp &sampleTimeStamp, uint32_t senderStamp) noexcept {
+        return sendDatagram(serialize(message, sampleTimeStamp, senderStamp));
+    }
+
+    /**
+     * @return The given message as Envelope with OD4 header, i.e., the
+     *         datagram that cluon::OD4Session::send would send.
+     */
+    template <typename T>
+    static std::string serialize(T &message, const cluon::data::TimeStamp &sampleTimeStamp, uint32_t senderStamp) noexcept {
+        cluon::ToProtoVisitor protoEncoder;
+        message.accept(protoEncoder);
+
+        cluon::data::Envelope envelope;
+        envelope.dataType(static_cast<int32_t>(message.ID()));
+        envelope.serializedData(protoEncoder.encodedData());
+        envelope.sent(cluon::time::now());
+        envelope.sampleTimeStamp((0 == (sampleTimeStamp.seconds() + sampleTimeStamp.microseconds())) ? envelope.sent() : sampleTimeStamp);
+        envelope.senderStamp(senderStamp);
+        return cluon::serializeEnvelope(std::move(envelope));
+    }
+
+    /**
+     * This method sends the given datagrams, e.g., from serialize(), with as
+     * few system calls as possible.
+     *
+     * @return Number of datagrams sent.
+     */
+    std::size_t sendBatch(const std::vector<std::string> &datagrams) noexcept;
+
+    /**
+     * This method sets the MTU of the network that limits the datagrams sent
+     * with segmentation offload (default: 1500).
+     */
+    void setMtu(uint32_t mtu) noexcept;
+
+    /**
+     * This method selects how sendPaced() enforces departure times.
+     *
+     * @param kernel Let the kernel pace with SO_TXTIME or, on kernels before
+     *               4.19, SO_MAX_PACING_RATE instead of sleeping in user space.
+     * @return Method that is used.
+     */
+    PacingMode enablePacing(bool kernel) noexcept;
+
+    /**
+     * This method sends the given datagrams at the departure times from the
+     * given pacer, whose rate must be set for the frame.
+     *
+     * @return Number of datagrams sent.
+     */
+    std::size_t sendPaced(const std::vector<std::string> &datagrams, Pacer &pacer) noexcept;
+
+    /**
+     * @return Number of system calls used for sending so far.
+     */
+    uint64_t systemCalls() const noexcept;
+
+    /**
+     * @return Number of datagrams sent so far.
+     */
+    uint64_t datagrams() const noexcept;
+
+    /**
+     * This method sends the given h264 frame as ImageReading.
+     *
+     * @return false if the Envelope does not fit into a datagram or sending failed.
+     */
+    bool sendImageReading(const uint8_t *data, uint32_t size, uint32_t width, uint32_t height,
+                          const cluon::data::TimeStamp &sampleTimeStamp, uint32_t senderStamp) noexcept;
+
+   private:
+    bool sendDatagram(const std::string &datagram) noexcept;
+    std::size_t sendSegmented(const std::vector<std::string> &datagrams, std::size_t first, bool &rejected) noexcept;
+    std::size_t sendMultiple(const std::vector<std::string> &datagrams, std::size_t first, std::size_t last, const int64_t *departures) noexcept;
+    uint64_t droppedByKernel() noexcept;
+
+   private:
+    int32_t m_socket{-1};
+    struct sockaddr_in m_address{};
+    // OD4 header, Envelope fields before the payload, and ImageReading fields.
+    std::array<uint8_t, 64> m_header{};
+    // Envelope fields after the payload: time stamps and senderStamp.
+    std::array<uint8_t, 64> m_trailer{};
+
+    bool m_segmentationOffload{true};
+    uint32_t m_maxSegmentSize{1500 - 20 - 8}; // MTU minus IP and UDP headers
+    bool m_sendMultiple{true};
+    std::vector<struct iovec> m_iovecs{};
+    std::vector<struct mmsghdr> m_messages{};
+
+    PacingMode m_pacingMode{PacingMode::USER_SPACE};
+    uint64_t m_pacingRate{0};
+    std::vector<int64_t> m_departures{};
+    // One control message with the departure time per datagram; uint64_t
+    // keeps the alignment that cmsghdr needs.
+    std::vector<uint64_t> m_controls{};
+    uint64_t m_systemCalls{0};
+    uint64_t m_datagrams{0};
+};
+
+#endif
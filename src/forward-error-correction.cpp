@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "forward-error-correction.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #include <arm_neon.h>
+    #define HAVE_NEON
+#endif
+
+namespace ForwardErrorCorrection {
+    // Logarithms to the base 2 and their inverse, doubled to save the modulo.
+    struct Tables {
+        std::array<uint8_t, 256> log{};
+        std::array<uint8_t, 510> exp{};
+        Tables() noexcept {
+            uint32_t v{1};
+            for (uint32_t i{0}; i < 255; i++) {
+                exp[i] = exp[i + 255] = static_cast<uint8_t>(v);
+                log[v] = static_cast<uint8_t>(i);
+                v <<= 1;
+                v ^= (0x100 & v) ? 0x11d : 0;
+            }
+        }
+    };
+
+    static const Tables &tables() noexcept {
+        static const Tables TABLES;
+        return TABLES;
+    }
+
+    static uint8_t inverse(uint8_t a) noexcept {
+        const Tables &T{tables()};
+        return T.exp[255 - T.log[a]];
+    }
+
+    uint8_t multiply(uint8_t a, uint8_t b) noexcept {
+        if ( (0 == a) || (0 == b) ) {
+            return 0;
+        }
+        const Tables &T{tables()};
+        return T.exp[T.log[a] + T.log[b]];
+    }
+
+    // Multiplies as far as possible with vector instructions by adding up the
+    // products with the powers of two selected by the bits of factor; every
+    // power is the previous one shifted by one bit and reduced by 0x1d.
+    static std::size_t multiplyAddSIMD(uint8_t *dst, const uint8_t *src, uint8_t factor, std::size_t length) noexcept {
+        std::size_t i{0};
+#if defined(__SSE2__)
+        const __m128i POLYNOMIAL = _mm_set1_epi8(0x1d);
+        const __m128i ZERO = _mm_setzero_si128();
+        for (; (i + 16) <= length; i += 16) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            __m128i sum = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+            for (uint32_t f{factor}; 0 != f; f >>= 1) {
+                if (0 != (f & 1)) {
+                    sum = _mm_xor_si128(sum, x);
+                }
+                const __m128i CARRY = _mm_cmplt_epi8(x, ZERO);
+                x = _mm_xor_si128(_mm_add_epi8(x, x), _mm_and_si128(CARRY, POLYNOMIAL));
+            }
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), sum);
+        }
+#elif defined(HAVE_NEON)
+        const uint8x16_t POLYNOMIAL = vdupq_n_u8(0x1d);
+        for (; (i + 16) <= length; i += 16) {
+            uint8x16_t x = vld1q_u8(src + i);
+            uint8x16_t sum = vld1q_u8(dst + i);
+            for (uint32_t f{factor}; 0 != f; f >>= 1) {
+                if (0 != (f & 1)) {
+                    sum = veorq_u8(sum, x);
+                }
+                const uint8x16_t CARRY = vreinterpretq_u8_s8(vshrq_n_s8(vreinterpretq_s8_u8(x), 7));
+                x = veorq_u8(vshlq_n_u8(x, 1), vandq_u8(CARRY, POLYNOMIAL));
+            }
+            vst1q_u8(dst + i, sum);
+        }
+#else
+        (void)dst; (void)src; (void)factor; (void)length;
+#endif
+        return i;
+    }
+
+    void multiplyAdd(uint8_t *dst, const uint8_t *src, uint8_t factor, std::size_t length) noexcept {
+        if (0 == factor) {
+            return;
+        }
+        std::size_t i{0};
+        if (1 == factor) {
+            // Repair symbol 0 and most of decoding with a single loss.
+            for (; (i + sizeof(uint64_t)) <= length; i += sizeof(uint64_t)) {
+                uint64_t d, s;
+                std::memcpy(&d, dst + i, sizeof(d));
+                std::memcpy(&s, src + i, sizeof(s));
+                d ^= s;
+                std::memcpy(dst + i, &d, sizeof(d));
+            }
+        }
+        else {
+            i = multiplyAddSIMD(dst, src, factor, length);
+        }
+        for (; i < length; i++) {
+            dst[i] ^= multiply(factor, src[i]);
+        }
+    }
+
+    uint8_t coefficient(uint32_t repairIndex, uint32_t dataIndex) noexcept {
+        // 1 / (x_i + y_j) scaled by 1 / (1 / (x_0 + y_j)) = y_j.
+        const uint8_t Y{static_cast<uint8_t>(255 - (dataIndex & 0xFF))};
+        return multiply(Y, inverse(static_cast<uint8_t>((repairIndex & 0xFF) ^ Y)));
+    }
+
+    void encode(const uint8_t *data, uint32_t size, uint32_t symbolSize, uint32_t repairIndex, uint8_t *repair) noexcept {
+        std::memset(repair, 0, symbolSize);
+        uint32_t j{0};
+        for (uint32_t offset{0}; offset < size; offset += symbolSize, j++) {
+            multiplyAdd(repair, data + offset, coefficient(repairIndex, j), std::min(symbolSize, size - offset));
+        }
+    }
+
+    bool decode(uint8_t *data, uint32_t dataCount, uint32_t symbolSize, const std::vector<bool> &received,
+                const std::map<uint32_t, std::string> &repairs) noexcept {
+        std::vector<uint32_t> missing;
+        for (uint32_t j{0}; j < dataCount; j++) {
+            if (!received[j]) {
+                missing.push_back(j);
+            }
+        }
+        const std::size_t E{missing.size()};
+        if (0 == E) {
+            return true;
+        }
+        if (repairs.size() < E) {
+            return false;
+        }
+
+        // Subtracting the received symbols from E repair symbols leaves E
+        // equations in the missing symbols.
+        std::vector<uint32_t> rows;
+        std::vector<std::string> syndromes;
+        for (auto it{repairs.begin()}; (it != repairs.end()) && (rows.size() < E); ++it) {
+            if (it->second.size() != symbolSize) {
+                continue;
+            }
+            rows.push_back(it->first);
+            syndromes.push_back(it->second);
+            uint8_t *s{reinterpret_cast<uint8_t*>(&syndromes.back()[0])};
+            for (uint32_t j{0}; j < dataCount; j++) {
+                if (received[j]) {
+                    multiplyAdd(s, data + static_cast<std::size_t>(j) * symbolSize, coefficient(it->first, j), symbolSize);
+                }
+            }
+        }
+        if (rows.size() < E) {
+            return false;
+        }
+
+        // Invert the E x E matrix of coefficients with Gauss-Jordan elimination;
+        // being a square part of a Cauchy matrix, it is never singular.
+        std::vector<uint8_t> m(E * E);
+        std::vector<uint8_t> inv(E * E, 0);
+        for (std::size_t r{0}; r < E; r++) {
+            for (std::size_t c{0}; c < E; c++) {
+                m[r * E + c] = coefficient(rows[r], missing[c]);
+            }
+            inv[r * E + r] = 1;
+        }
+        for (std::size_t c{0}; c < E; c++) {
+            std::size_t pivot{c};
+            while ( (pivot < E) && (0 == m[pivot * E + c]) ) {
+                pivot++;
+            }
+            if (pivot == E) {
+                return false;
+            }
+            for (std::size_t k{0}; k < E; k++) {
+                std::swap(m[c * E + k], m[pivot * E + k]);
+                std::swap(inv[c * E + k], inv[pivot * E + k]);
+            }
+            const uint8_t SCALE{inverse(m[c * E + c])};
+            for (std::size_t k{0}; k < E; k++) {
+                m[c * E + k] = multiply(m[c * E + k], SCALE);
+                inv[c * E + k] = multiply(inv[c * E + k], SCALE);
+            }
+            for (std::size_t r{0}; r < E; r++) {
+                const uint8_t FACTOR{m[r * E + c]};
+                if ( (r != c) && (0 != FACTOR) ) {
+                    for (std::size_t k{0}; k < E; k++) {
+                        m[r * E + k] ^= multiply(FACTOR, m[c * E + k]);
+                        inv[r * E + k] ^= multiply(FACTOR, inv[c * E + k]);
+                    }
+                }
+            }
+        }
+
+        for (std::size_t c{0}; c < E; c++) {
+            uint8_t *d{data + static_cast<std::size_t>(missing[c]) * symbolSize};
+            std::memset(d, 0, symbolSize);
+            for (std::size_t r{0}; r < E; r++) {
+                multiplyAdd(d, reinterpret_cast<const uint8_t*>(syndromes[r].data()), inv[c * E + r], symbolSize);
+            }
+        }
+        return true;
+    }
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef FORWARD_ERROR_CORRECTION_HPP
+#define FORWARD_ERROR_CORRECTION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+ * Systematic Reed-Solomon erasure code over GF(2^8) (polynomial 0x11d) for
+ * the fragments of a frame: the k fragments of a frame are the data symbols,
+ * all of fragmentSize bytes with the last one padded with zeros, and repair
+ * symbol i is
+ *
+ *   repair_i = sum over j of coefficient(i, j) * fragment_j
+ *
+ * The coefficients form a Cauchy matrix with x_i = i and y_j = 255 - j whose
+ * columns are scaled so that repair symbol 0 is the XOR of all fragments;
+ * any k of the k + m symbols restore the frame as long as k + m <= 256.
+ */
+namespace ForwardErrorCorrection {
+    constexpr uint32_t MAX_SYMBOLS{256};
+
+    /**
+     * @return Product of a and b in GF(2^8).
+     */
+    uint8_t multiply(uint8_t a, uint8_t b) noexcept;
+
+    /**
+     * This function computes dst ^= factor * src for length bytes with SSE2
+     * or NEON where available.
+     */
+    void multiplyAdd(uint8_t *dst, const uint8_t *src, uint8_t factor, std::size_t length) noexcept;
+
+    /**
+     * @return Coefficient of data symbol dataIndex in repair symbol repairIndex.
+     */
+    uint8_t coefficient(uint32_t repairIndex, uint32_t dataIndex) noexcept;
+
+    /**
+     * This function computes one repair symbol.
+     *
+     * @param data Frame of size bytes; the symbols are the consecutive
+     *             symbolSize bytes of the frame.
+     * @param repair Destination of symbolSize bytes.
+     */
+    void encode(const uint8_t *data, uint32_t size, uint32_t symbolSize, uint32_t repairIndex, uint8_t *repair) noexcept;
+
+    /**
+     * This function restores the missing data symbols in place.
+     *
+     * @param data dataCount symbols of symbolSize bytes; missing ones are
+     *             overwritten.
+     * @param received Which of the data symbols were received.
+     * @param repairs Received repair symbols of symbolSize bytes by index.
+     * @return false if fewer repair symbols than missing data symbols are
+     *         given.
+     */
+    bool decode(uint8_t *data, uint32_t dataCount, uint32_t symbolSize, const std::vector<bool> &received,
+                const std::map<uint32_t, std::string> &repairs) noexcept;
+}
+
+#endif
@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "fragment-reassembler.hpp"
+#include "forward-error-correction.hpp"
+
+#include <cstring>
+#include <utility>
+
+FragmentReassembler::FragmentReassembler(uint32_t maxFramesInFlight) noexcept
+    : m_maxFramesInFlight{maxFramesInFlight} {}
+
+uint64_t FragmentReassembler::completed() const noexcept {
+    return m_completed;
+}
+
+uint64_t FragmentReassembler::lost() const noexcept {
+    return m_lost;
+}
+
+uint64_t FragmentReassembler::recovered() const noexcept {
+    return m_recovered;
+}
+
+FragmentReassembler::PartialFrame *FragmentReassembler::partialFrame(uint32_t frameId, uint32_t fragmentCount, uint32_t frameSize) noexcept {
+    // Frame ids wrap around; differences are thus taken modulo 2^32. A frame
+    // id far behind the newest one means that the sender was restarted.
+    constexpr int32_t RESTART{1024};
+    const int32_t AGE{static_cast<int32_t>(m_newestFrameId - frameId)};
+    if (!m_hasNewestFrameId || (0 > AGE) || (RESTART < AGE)) {
+        m_newestFrameId = frameId;
+        m_hasNewestFrameId = true;
+    }
+    else if (AGE > static_cast<int32_t>(m_maxFramesInFlight)) {
+        // Too late; the frame has already been given up.
+        return nullptr;
+    }
+    for (auto it{m_frames.begin()}; it != m_frames.end();) {
+        const int32_t ENTRY_AGE{static_cast<int32_t>(m_newestFrameId - it->first)};
+        if ( (0 > ENTRY_AGE) || (ENTRY_AGE > static_cast<int32_t>(m_maxFramesInFlight)) ) {
+            m_lost += (0 < it->second.missing) ? 1 : 0;
+            it = m_frames.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    PartialFrame &partial{m_frames[frameId]};
+    if (partial.received.empty()) {
+        partial.data.resize(frameSize);
+        partial.received.resize(fragmentCount, false);
+        partial.missing = fragmentCount;
+    }
+    if (0 == partial.missing) {
+        // Duplicate of a frame that is already complete.
+        return nullptr;
+    }
+    if ( (partial.received.size() != fragmentCount) || (partial.data.size() != frameSize) ) {
+        // Inconsistent with the fragments received before.
+        return nullptr;
+    }
+    return &partial;
+}
+
+bool FragmentReassembler::complete(PartialFrame &partial, std::string &frame) noexcept {
+    if ( (0 < partial.missing) && (partial.missing <= partial.repairs.size()) ) {
+        // The code works on whole symbols; the padding of the last fragment is zero.
+        const uint32_t COUNT{static_cast<uint32_t>(partial.received.size())};
+        const std::size_t SIZE{partial.data.size()};
+        partial.data.resize(static_cast<std::size_t>(COUNT) * partial.fragmentSize, '\0');
+        if (ForwardErrorCorrection::decode(reinterpret_cast<uint8_t*>(&partial.data[0]), COUNT, partial.fragmentSize, partial.received, partial.repairs)) {
+            partial.missing = 0;
+            m_recovered++;
+        }
+        partial.data.resize(SIZE);
+    }
+    if (0 < partial.missing) {
+        return false;
+    }
+
+    // The entry is kept until it leaves the window to recognize duplicates.
+    frame = std::move(partial.data);
+    partial.data = std::string{};
+    partial.repairs.clear();
+    m_completed++;
+    return true;
+}
+
+bool FragmentReassembler::add(const opendlv::proxy::ImageReadingFragment &fragment, std::string &frame) noexcept {
+    const uint32_t COUNT{fragment.fragmentCount()};
+    const uint32_t INDEX{fragment.fragmentIndex()};
+    const std::string &DATA{fragment.data()};
+    if ( (0 == COUNT) || (INDEX >= COUNT) ||
+         (static_cast<uint64_t>(fragment.offset()) + DATA.size() > fragment.frameSize()) ) {
+        return false;
+    }
+
+    PartialFrame *partial{partialFrame(fragment.frameId(), COUNT, fragment.frameSize())};
+    if (nullptr == partial) {
+        return false;
+    }
+    if (!partial->received[INDEX]) {
+        std::memcpy(&partial->data[fragment.offset()], DATA.data(), DATA.size());
+        partial->received[INDEX] = true;
+        partial->missing--;
+    }
+    return complete(*partial, frame);
+}
+
+bool FragmentReassembler::add(const opendlv::proxy::ImageReadingRepair &repair, std::string &frame) noexcept {
+    const uint32_t COUNT{repair.fragmentCount()};
+    const uint32_t SIZE{repair.fragmentSize()};
+    // The fragments must cover the frame with a non-empty last one.
+    if ( (0 == COUNT) || (0 == SIZE) || (repair.data().size() != SIZE) ||
+         ((COUNT + repair.repairIndex()) >= ForwardErrorCorrection::MAX_SYMBOLS) ||
+         (static_cast<uint64_t>(COUNT) * SIZE < repair.frameSize()) ||
+         (static_cast<uint64_t>(COUNT - 1) * SIZE >= repair.frameSize()) ) {
+        return false;
+    }
+
+    PartialFrame *partial{partialFrame(repair.frameId(), COUNT, repair.frameSize())};
+    if ( (nullptr == partial) || ((0 != partial->fragmentSize) && (SIZE != partial->fragmentSize)) ) {
+        return false;
+    }
+    partial->fragmentSize = SIZE;
+    partial->repairs.emplace(repair.repairIndex(), repair.data());
+    return complete(*partial, frame);
+}
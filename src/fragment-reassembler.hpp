@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAGMENT_REASSEMBLER_HPP
+#define FRAGMENT_REASSEMBLER_HPP
+
+#include "opendlv-video-x264-encoder-message-set.hpp"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * This class restores complete h264 frames from the
+ * opendlv::proxy::ImageReadingFragment messages of one sender; it is meant to
+ * be used by receivers, e.g., from an OD4Session's dataTrigger:
+ *
+ *   FragmentReassembler reassembler;
+ *   std::string frame;
+ *   if (reassembler.add(fragment, frame)) { decode(frame); }
+ *
+ * Fragments may arrive in any order and duplicates are ignored. Frames that
+ * are still incomplete when more than maxFramesInFlight newer frames have
+ * been started are discarded and counted as lost.
+ *
+ * With forward error correction, opendlv::proxy::ImageReadingRepair messages
+ * are passed to the same instance; as soon as the number of fragments and
+ * repairs received for a frame reaches the number of its fragments, the
+ * missing fragments are restored.
+ */
+class FragmentReassembler {
+   private:
+    FragmentReassembler(const FragmentReassembler &) = delete;
+    FragmentReassembler(FragmentReassembler &&)      = delete;
+    FragmentReassembler &operator=(const FragmentReassembler &) = delete;
+    FragmentReassembler &operator=(FragmentReassembler &&) = delete;
+
+   public:
+    explicit FragmentReassembler(uint32_t maxFramesInFlight = 4) noexcept;
+    ~FragmentReassembler() = default;
+
+    /**
+     * @param fragment Received fragment.
+     * @param frame Complete frame if this fragment was the last one missing.
+     * @return true if frame holds a complete frame.
+     */
+    bool add(const opendlv::proxy::ImageReadingFragment &fragment, std::string &frame) noexcept;
+
+    /**
+     * @param repair Received repair data.
+     * @param frame Complete frame if this repair was the last one missing.
+     * @return true if frame holds a complete frame.
+     */
+    bool add(const opendlv::proxy::ImageReadingRepair &repair, std::string &frame) noexcept;
+
+    /**
+     * @return Number of frames restored completely.
+     */
+    uint64_t completed() const noexcept;
+
+    /**
+     * @return Number of frames discarded because fragments were missing.
+     */
+    uint64_t lost() const noexcept;
+
+    /**
+     * @return Number of completed frames that needed repair data.
+     */
+    uint64_t recovered() const noexcept;
+
+   private:
+    struct PartialFrame {
+        std::string data{};
+        std::vector<bool> received{};
+        uint32_t missing{0};
+        std::map<uint32_t, std::string> repairs{};
+        uint32_t fragmentSize{0};
+    };
+
+    PartialFrame *partialFrame(uint32_t frameId, uint32_t fragmentCount, uint32_t frameSize) noexcept;
+    bool complete(PartialFrame &partial, std::string &frame) noexcept;
+
+    const uint32_t m_maxFramesInFlight;
+    std::map<uint32_t, PartialFrame> m_frames{};
+    uint32_t m_newestFrameId{0};
+    bool m_hasNewestFrameId{false};
+    uint64_t m_completed{0};
+    uint64_t m_lost{0};
+    uint64_t m_recovered{0};
+};
+
+#endif
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "frame-buffer-pool.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+FrameBufferPool::FrameBufferPool(uint32_t numberOfBuffers, std::size_t sizeOfBuffer) noexcept
+    : m_size{sizeOfBuffer} {
+    // Round up to a multiple of the alignment so that every copy can use full vector stores.
+    const std::size_t ALIGNED_SIZE{(sizeOfBuffer + ALIGNMENT - 1) & ~(ALIGNMENT - 1)};
+    for (uint32_t i{0}; i < numberOfBuffers; i++) {
+        void *ptr{nullptr};
+        if (0 == ::posix_memalign(&ptr, ALIGNMENT, ALIGNED_SIZE)) {
+            std::memset(ptr, 0, ALIGNED_SIZE);
+            m_buffers.push_back(reinterpret_cast<uint8_t*>(ptr));
+        }
+    }
+    if (m_buffers.size() != numberOfBuffers) {
+        for (auto b : m_buffers) {
+            ::free(b);
+        }
+        m_buffers.clear();
+    }
+}
+
+FrameBufferPool::~FrameBufferPool() noexcept {
+    for (auto b : m_buffers) {
+        ::free(b);
+    }
+    m_buffers.clear();
+}
+
+bool FrameBufferPool::valid() const noexcept {
+    return !m_buffers.empty();
+}
+
+std::size_t FrameBufferPool::size() const noexcept {
+    return m_size;
+}
+
+uint8_t *FrameBufferPool::next() noexcept {
+    if (m_buffers.empty()) {
+        return nullptr;
+    }
+    uint8_t *retVal{m_buffers[m_next]};
+    m_next = (m_next + 1) % static_cast<uint32_t>(m_buffers.size());
+    return retVal;
+}
+
+void copyFrame(uint8_t *dst, const uint8_t *src, std::size_t length) noexcept {
+#if defined(__SSE2__)
+    if (0 == (reinterpret_cast<uintptr_t>(dst) & 15)) {
+        constexpr std::size_t BLOCK{64};
+        std::size_t i{0};
+        for (; (i + BLOCK) <= length; i += BLOCK) {
+            const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 16));
+            const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 32));
+            const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 48));
+            _mm_stream_si128(reinterpret_cast<__m128i*>(dst + i), a);
+            _mm_stream_si128(reinterpret_cast<__m128i*>(dst + i + 16), b);
+            _mm_stream_si128(reinterpret_cast<__m128i*>(dst + i + 32), c);
+            _mm_stream_si128(reinterpret_cast<__m128i*>(dst + i + 48), d);
+        }
+        // Make the non-temporal stores globally visible before the lock is released.
+        _mm_sfence();
+        if (i < length) {
+            std::memcpy(dst + i, src + i, length - i);
+        }
+        return;
+    }
+#endif
+    std::memcpy(dst, src, length);
+}
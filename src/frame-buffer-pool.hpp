@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FRAME_BUFFER_POOL_HPP
+#define FRAME_BUFFER_POOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * This class provides a fixed set of pre-allocated, 64-byte aligned buffers
+ * that are handed out in round-robin order. It is used to take a private
+ * snapshot of a frame residing in a shared memory area so that the lock can
+ * be released before the frame is encoded.
+ */
+class FrameBufferPool {
+   private:
+    FrameBufferPool(const FrameBufferPool &) = delete;
+    FrameBufferPool(FrameBufferPool &&)      = delete;
+    FrameBufferPool &operator=(const FrameBufferPool &) = delete;
+    FrameBufferPool &operator=(FrameBufferPool &&) = delete;
+
+   public:
+    static constexpr std::size_t ALIGNMENT{64};
+
+   public:
+    /**
+     * @param numberOfBuffers Number of buffers to allocate.
+     * @param sizeOfBuffer Size in bytes of each buffer.
+     */
+    FrameBufferPool(uint32_t numberOfBuffers, std::size_t sizeOfBuffer) noexcept;
+    ~FrameBufferPool() noexcept;
+
+    /**
+     * @return true if all buffers could be allocated.
+     */
+    bool valid() const noexcept;
+
+    /**
+     * @return Size in bytes of each buffer.
+     */
+    std::size_t size() const noexcept;
+
+    /**
+     * @return Next buffer in round-robin order.
+     */
+    uint8_t *next() noexcept;
+
+   private:
+    std::vector<uint8_t*> m_buffers{};
+    std::size_t m_size{0};
+    uint32_t m_next{0};
+};
+
+/**
+ * This function copies a frame as fast as possible from src to dst. On x86
+ * with SSE2, non-temporal stores are used when dst is aligned to avoid
+ * polluting the cache with data that is read only once by the encoder.
+ *
+ * @param dst Destination buffer.
+ * @param src Source buffer.
+ * @param length Number of bytes to copy.
+ */
+void copyFrame(uint8_t *dst, const uint8_t *src, std::size_t length) noexcept;
+
+#endif
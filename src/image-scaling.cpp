@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "image-scaling.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+    #include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #include <arm_neon.h>
+    #define HAVE_NEON
+#endif
+
+// Halves two rows as far as possible with vector instructions and returns
+// the number of destination pixels processed.
+static uint32_t halveRowsSIMD(const uint8_t *s0, const uint8_t *s1, uint8_t *d, uint32_t dstWidth) noexcept {
+    uint32_t x{0};
+#if defined(__SSE2__)
+    const __m128i MASK = _mm_set1_epi16(0x00FF);
+    const __m128i TWO = _mm_set1_epi16(2);
+    for (; (x + 16) <= dstWidth; x += 16) {
+        const __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s0 + 2 * x));
+        const __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s0 + 2 * x + 16));
+        const __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s1 + 2 * x));
+        const __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s1 + 2 * x + 16));
+        // Sums of the even and odd columns of both rows as 16-bit lanes.
+        const __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a0, MASK), _mm_srli_epi16(a0, 8)),
+                                         _mm_add_epi16(_mm_and_si128(b0, MASK), _mm_srli_epi16(b0, 8)));
+        const __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a1, MASK), _mm_srli_epi16(a1, 8)),
+                                         _mm_add_epi16(_mm_and_si128(b1, MASK), _mm_srli_epi16(b1, 8)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(d + x),
+                         _mm_packus_epi16(_mm_srli_epi16(_mm_add_epi16(lo, TWO), 2), _mm_srli_epi16(_mm_add_epi16(hi, TWO), 2)));
+    }
+#elif defined(HAVE_NEON)
+    for (; (x + 16) <= dstWidth; x += 16) {
+        const uint8x16x2_t a = vld2q_u8(s0 + 2 * x);
+        const uint8x16x2_t b = vld2q_u8(s1 + 2 * x);
+        uint16x8_t lo = vaddl_u8(vget_low_u8(a.val[0]), vget_low_u8(a.val[1]));
+        uint16x8_t hi = vaddl_u8(vget_high_u8(a.val[0]), vget_high_u8(a.val[1]));
+        lo = vaddq_u16(lo, vaddl_u8(vget_low_u8(b.val[0]), vget_low_u8(b.val[1])));
+        hi = vaddq_u16(hi, vaddl_u8(vget_high_u8(b.val[0]), vget_high_u8(b.val[1])));
+        vst1q_u8(d + x, vcombine_u8(vrshrn_n_u16(lo, 2), vrshrn_n_u16(hi, 2)));
+    }
+#else
+    (void)s0; (void)s1; (void)d; (void)dstWidth;
+#endif
+    return x;
+}
+
+void halvePlane(const uint8_t *src, int32_t srcStride,
+                uint8_t *dst, int32_t dstStride, uint32_t dstWidth, uint32_t dstHeight) noexcept {
+    for (uint32_t row{0}; row < dstHeight; row++) {
+        const uint8_t *s0{src + static_cast<int64_t>(2 * row) * srcStride};
+        const uint8_t *s1{s0 + srcStride};
+        uint8_t *d{dst + static_cast<int64_t>(row) * dstStride};
+        uint32_t x{halveRowsSIMD(s0, s1, d, dstWidth)};
+        for (; x < dstWidth; x++) {
+            d[x] = static_cast<uint8_t>((s0[2 * x] + s0[2 * x + 1] + s1[2 * x] + s1[2 * x + 1] + 2) >> 2);
+        }
+    }
+}
+
+void resizePlane(const uint8_t *src, int32_t srcStride, uint32_t srcWidth, uint32_t srcHeight,
+                 uint8_t *dst, int32_t dstStride, uint32_t dstWidth, uint32_t dstHeight) noexcept {
+    if ( (0 == dstWidth) || (0 == dstHeight) ) {
+        return;
+    }
+    // Source positions of the pixel centers in 16.16 fixed point.
+    const uint32_t STEP_X{static_cast<uint32_t>((static_cast<uint64_t>(srcWidth) << 16) / dstWidth)};
+    const uint32_t STEP_Y{static_cast<uint32_t>((static_cast<uint64_t>(srcHeight) << 16) / dstHeight)};
+    const int64_t MAX_X{static_cast<int64_t>(srcWidth - 1) << 16};
+    const int64_t MAX_Y{static_cast<int64_t>(srcHeight - 1) << 16};
+
+    std::vector<uint32_t> xs(dstWidth);
+    std::vector<uint16_t> wxs(dstWidth);
+    for (uint32_t x{0}; x < dstWidth; x++) {
+        const int64_t SX{std::min(MAX_X, std::max<int64_t>(0, static_cast<int64_t>(x) * STEP_X + STEP_X / 2 - 0x8000))};
+        xs[x] = static_cast<uint32_t>(SX >> 16);
+        wxs[x] = static_cast<uint16_t>((SX & 0xFFFF) >> 8);
+    }
+    for (uint32_t y{0}; y < dstHeight; y++) {
+        const int64_t SY{std::min(MAX_Y, std::max<int64_t>(0, static_cast<int64_t>(y) * STEP_Y + STEP_Y / 2 - 0x8000))};
+        const uint32_t Y0{static_cast<uint32_t>(SY >> 16)};
+        const uint32_t Y1{std::min(Y0 + 1, srcHeight - 1)};
+        const uint32_t WY{static_cast<uint32_t>((SY & 0xFFFF) >> 8)};
+        const uint8_t *s0{src + static_cast<int64_t>(Y0) * srcStride};
+        const uint8_t *s1{src + static_cast<int64_t>(Y1) * srcStride};
+        uint8_t *d{dst + static_cast<int64_t>(y) * dstStride};
+        for (uint32_t x{0}; x < dstWidth; x++) {
+            const uint32_t X0{xs[x]};
+            const uint32_t X1{std::min(X0 + 1, srcWidth - 1)};
+            const uint32_t WX{wxs[x]};
+            const uint32_t TOP{s0[X0] * (256 - WX) + s0[X1] * WX};
+            const uint32_t BOTTOM{s1[X0] * (256 - WX) + s1[X1] * WX};
+            d[x] = static_cast<uint8_t>((TOP * (256 - WY) + BOTTOM * WY + 32768) >> 16);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+ScalingPyramid::ScalingPyramid(uint32_t width, uint32_t height, uint32_t smallestWidth, uint32_t smallestHeight) noexcept {
+    m_levels.emplace_back();
+    m_levels[0].width = width;
+    m_levels[0].height = height;
+
+    // Halved levels are kept as long as they are not smaller than the
+    // smallest rendition; their widths are rounded to multiples of 64 bytes.
+    std::size_t size{0};
+    uint32_t w{width / 2};
+    uint32_t h{height / 2};
+    while ( (w >= smallestWidth) && (h >= smallestHeight) && (2 <= w) && (2 <= h) ) {
+        Level level;
+        level.width = w & ~1u;
+        level.height = h & ~1u;
+        level.strides[0] = static_cast<int32_t>((level.width + 63) & ~63u);
+        level.strides[1] = level.strides[2] = static_cast<int32_t>((level.width / 2 + 63) & ~63u);
+        size += static_cast<std::size_t>(level.strides[0]) * level.height + 2 * static_cast<std::size_t>(level.strides[1]) * (level.height / 2);
+        m_levels.push_back(level);
+        w = level.width / 2;
+        h = level.height / 2;
+    }
+    m_buffer.resize(size);
+    uint8_t *p{m_buffer.data()};
+    for (std::size_t i{1}; i < m_levels.size(); i++) {
+        Level &level{m_levels[i]};
+        level.planes[0] = p;
+        p += static_cast<std::size_t>(level.strides[0]) * level.height;
+        level.planes[1] = p;
+        p += static_cast<std::size_t>(level.strides[1]) * (level.height / 2);
+        level.planes[2] = p;
+        p += static_cast<std::size_t>(level.strides[2]) * (level.height / 2);
+    }
+}
+
+void ScalingPyramid::build(uint8_t *const planes[3], const int32_t strides[3]) noexcept {
+    for (uint32_t i{0}; i < 3; i++) {
+        m_levels[0].planes[i] = planes[i];
+        m_levels[0].strides[i] = strides[i];
+    }
+    for (std::size_t l{1}; l < m_levels.size(); l++) {
+        const Level &SRC{m_levels[l - 1]};
+        Level &dst{m_levels[l]};
+        // The level's own even size bounds the writes: halving an odd source
+        // size would otherwise spill one row into the next plane.
+        for (uint32_t i{0}; i < 3; i++) {
+            const uint32_t SHIFT{(0 == i) ? 0u : 1u};
+            halvePlane(SRC.planes[i], SRC.strides[i], dst.planes[i], dst.strides[i], dst.width >> SHIFT, dst.height >> SHIFT);
+        }
+    }
+}
+
+void ScalingPyramid::scale(uint32_t width, uint32_t height, uint8_t *const planes[3], const int32_t strides[3]) const noexcept {
+    std::size_t l{0};
+    while ( ((l + 1) < m_levels.size()) && (m_levels[l + 1].width >= width) && (m_levels[l + 1].height >= height) ) {
+        l++;
+    }
+    const Level &SRC{m_levels[l]};
+    for (uint32_t i{0}; i < 3; i++) {
+        const uint32_t SHIFT{(0 == i) ? 0u : 1u};
+        const uint32_t W{width >> SHIFT};
+        const uint32_t H{height >> SHIFT};
+        if ( (SRC.width == width) && (SRC.height == height) ) {
+            for (uint32_t row{0}; row < H; row++) {
+                std::memcpy(planes[i] + static_cast<int64_t>(row) * strides[i], SRC.planes[i] + static_cast<int64_t>(row) * SRC.strides[i], W);
+            }
+        }
+        else {
+            resizePlane(SRC.planes[i], SRC.strides[i], SRC.width >> SHIFT, SRC.height >> SHIFT, planes[i], strides[i], W, H);
+        }
+    }
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IMAGE_SCALING_HPP
+#define IMAGE_SCALING_HPP
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * This function halves an 8-bit plane by averaging each 2x2 block and writes
+ * exactly dstWidth x dstHeight pixels; the source needs at least twice as
+ * many columns and rows.
+ */
+void halvePlane(const uint8_t *src, int32_t srcStride,
+                uint8_t *dst, int32_t dstStride, uint32_t dstWidth, uint32_t dstHeight) noexcept;
+
+/**
+ * This function resizes an 8-bit plane with bilinear interpolation, which is
+ * suitable for scale factors between 0.5 and 1.
+ */
+void resizePlane(const uint8_t *src, int32_t srcStride, uint32_t srcWidth, uint32_t srcHeight,
+                 uint8_t *dst, int32_t dstStride, uint32_t dstWidth, uint32_t dstHeight) noexcept;
+
+/**
+ * This class holds successively halved copies of an I420 frame so that
+ * several smaller renditions are derived from the frame read only once:
+ * every rendition is resized from the smallest level that is not smaller
+ * than the rendition itself, i.e., by a factor between 0.5 and 1.
+ */
+class ScalingPyramid {
+   private:
+    ScalingPyramid(const ScalingPyramid &) = delete;
+    ScalingPyramid(ScalingPyramid &&)      = delete;
+    ScalingPyramid &operator=(const ScalingPyramid &) = delete;
+    ScalingPyramid &operator=(ScalingPyramid &&) = delete;
+
+   public:
+    /**
+     * @param width Width of the full frame.
+     * @param height Height of the full frame.
+     * @param smallestWidth Width of the smallest rendition.
+     * @param smallestHeight Height of the smallest rendition.
+     */
+    ScalingPyramid(uint32_t width, uint32_t height, uint32_t smallestWidth, uint32_t smallestHeight) noexcept;
+
+    /**
+     * This method computes all levels from the given full frame, which must
+     * stay valid until the last call to scale().
+     */
+    void build(uint8_t *const planes[3], const int32_t strides[3]) noexcept;
+
+    /**
+     * This method writes the frame at the given size into the given planes.
+     */
+    void scale(uint32_t width, uint32_t height, uint8_t *const planes[3], const int32_t strides[3]) const noexcept;
+
+   private:
+    struct Level {
+        uint32_t width{0};
+        uint32_t height{0};
+        uint8_t *planes[3]{nullptr, nullptr, nullptr};
+        int32_t strides[3]{0, 0, 0};
+    };
+    std::vector<Level> m_levels{};
+    std::vector<uint8_t> m_buffer{};
+};
+
+#endif
@@ -16,17 +16,67 @@
  */
 
 #include "cluon-complete.hpp"
-#include "opendlv-standard-message-set.hpp"
+#include "colorspace-conversion.hpp"
+#include "encoder-worker.hpp"
+#include "stream-server.hpp"
+
+#include <sys/resource.h>
 
-extern "C" {
-    #include <x264.h>
-}
 #include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
-#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
 #include <vector>
 
+// Splits a comma-separated command line value into one value per camera.
+static std::vector<std::string> valuesPerCamera(const std::string &value) {
+    std::vector<std::string> retVal;
+    std::string::size_type prev{0};
+    for (std::string::size_type i{value.find(',')}; i != std::string::npos; prev = i + 1, i = value.find(',', prev)) {
+        retVal.emplace_back(value.substr(prev, i - prev));
+    }
+    retVal.emplace_back(value.substr(prev));
+    return retVal;
+}
+
+// Parses a port number from 1 to 65535 without throwing.
+static bool parsePort(const std::string &value, uint16_t &port) {
+    if ( value.empty() || (5 < value.size()) || (std::string::npos != value.find_first_not_of("0123456789")) ) {
+        return false;
+    }
+    const unsigned long PORT{std::strtoul(value.c_str(), nullptr, 10)};
+    if ( (0 == PORT) || (65535 < PORT) ) {
+        return false;
+    }
+    port = static_cast<uint16_t>(PORT);
+    return true;
+}
+
+// Kernel pacing needs the fq queue discipline, which is rarely the default.
+static bool fqIsDefaultQueueDiscipline() {
+    std::ifstream file("/proc/sys/net/core/default_qdisc");
+    std::string qdisc;
+    return (file >> qdisc) && ("fq" == qdisc);
+}
+
+// User and system time consumed by all threads of this process so far.
+static double cpuSeconds() {
+    struct rusage usage;
+    if (0 != ::getrusage(RUSAGE_SELF, &usage)) {
+        return 0.0;
+    }
+    return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+         + static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / (1000.0 * 1000.0);
+}
+
 int32_t main(int32_t argc, char **argv) {
     int32_t retCode{1};
     auto commandlineArguments = cluon::getCommandlineArguments(argc, argv);
@@ -34,136 +84,495 @@ int32_t main(int32_t argc, char **argv) {
          (0 == commandlineArguments.count("name")) ||
          (0 == commandlineArguments.count("width")) ||
          (0 == commandlineArguments.count("height")) ) {
-        std::cerr << argv[0] << " attaches to an I420-formatted image residing in a shared memory area to convert it into a corresponding h264 frame for publishing to a running OD4 session." << std::endl;
-        std::cerr << "Usage:   " << argv[0] << " --cid=<OpenDaVINCI session> --name=<name of shared memory area> --width=<width> --height=<height> [--gop=<GOP>] [--preset=X] [--verbose] [--id=<identifier in case of multiple instances]" << std::endl;
+        std::cerr << argv[0] << " attaches to an I420-formatted (or --format) image residing in a shared memory area to convert it into a corresponding h264 frame for publishing to a running OD4 session." << std::endl;
+        std::cerr << "Usage:   " << argv[0] << " --cid=<OpenDaVINCI session> --name=<name of shared memory area> --width=<width> --height=<height> [--gop=<GOP>] [--intra-refresh] [--preset=X] [--format=X] [--snapshot] [--ring] [--fps=<FPS>] [--vfr] [--threads=<N>] [--sliced-threads=<0|1>] [--rc=crf|abr|cbr] [--crf=<F>] [--bitrate=<kbit/s>] [--vbv-maxrate=<kbit/s>] [--vbv-bufsize=<kbit>] [--max-frame-size=<bytes>] [--slice-max-size=<bytes>|--mtu=<bytes>] [--fragment-size=<bytes>] [--fec=<percent>] [--min-keyframe-interval=<ms>] [--loss-recovery] [--zero-copy] [--send-only] [--batch] [--queue=<frames>] [--drop=oldest|non-reference] [--unix-socket=<path>] [--tcp-port=<port>] [--client-queue=<envelopes>] [--output-ring=<name>] [--output-ring-size=<MiB>] [--record=<file>] [--record-max-size=<MiB>] [--record-max-duration=<s>] [--rtp=<address>:<port>] [--rtp-mode=0|1] [--pacing=<percent>] [--pacing-burst=<bytes>] [--pacing-mode=auto|kernel|user] [--simulcast=<width>x<height>:<kbit/s>:<id>[,...]] [--frame-info] [--verbose] [--id=<identifier in case of multiple instances]" << std::endl;
         std::cerr << "         --cid:      CID of the OD4Session to send h264 frames" << std::endl;
-        std::cerr << "         --id:       when using several instances, this identifier is used as senderStamp" << std::endl;
+        std::cerr << "         --id:       when using several instances, this identifier is used as senderStamp; one per --name, default: position in --name" << std::endl;
         std::cerr << "         --name:     name of the shared memory area to attach" << std::endl;
         std::cerr << "         --width:    width of the frame" << std::endl;
         std::cerr << "         --height:   height of the frame" << std::endl;
         std::cerr << "         --gop:      optional: length of group of pictures (default = 10)" << std::endl;
+        std::cerr << "         --intra-refresh: replace periodic IDR frames by a column of intra macroblocks moving across each GOP" << std::endl;
         std::cerr << "         --preset:   one of x264's presets: ultrafast, superfast, veryfast, faster, fast, medium, slow, slower, veryslow; default: veryfast" << std::endl;
+        std::cerr << "         --format:   pixel format in the shared memory area: i420, nv12, yuyv, uyvy, rgb, bgr, rgba, bgra; default: i420" << std::endl;
+        std::cerr << "         --snapshot: copy the frame into a private buffer and release the shared memory before encoding" << std::endl;
+        std::cerr << "         --ring:     the shared memory area holds a ring of frame slots that is read without locking (implies --snapshot)" << std::endl;
+        std::cerr << "         --fps:      optional: nominal frame rate of the input (default = 20)" << std::endl;
+        std::cerr << "         --vfr:      use the sample time stamps from the shared memory as presentation time stamps (variable frame rate)" << std::endl;
+        std::cerr << "         --threads:  optional: number of x264 threads per camera; 0 = automatic (default = 1)" << std::endl;
+        std::cerr << "         --sliced-threads: optional: 1 = split each frame among the threads without added latency, 0 = frame threads with one frame latency per thread (default = 1)" << std::endl;
+        std::cerr << "         --rc:       optional: rate control: crf (constant quality), abr (average bitrate), cbr (constant bitrate); default: preset's default" << std::endl;
+        std::cerr << "         --crf:      optional: rate factor for --rc=crf (default = 23)" << std::endl;
+        std::cerr << "         --bitrate:  optional: target bitrate in kbit/s for --rc=abr and --rc=cbr" << std::endl;
+        std::cerr << "         --vbv-maxrate: optional: maximum bitrate in kbit/s of the video buffering verifier" << std::endl;
+        std::cerr << "         --vbv-bufsize: optional: buffer size in kbit of the video buffering verifier; capped to --max-frame-size" << std::endl;
+        std::cerr << "         --max-frame-size: optional: per-frame cap in bytes, enforced with a VBV buffer of one frame that refills at --vbv-maxrate, --bitrate, or one frame per frame interval; default: UDP payload budget minus Envelope overhead (" << (UDP_PAYLOAD_BUDGET - ENVELOPE_OVERHEAD) << ") without VBV" << std::endl;
+        std::cerr << "         --slice-max-size: optional: limit slices to this many bytes and publish each slice as opendlv.proxy.ImageReadingSlice" << std::endl;
+        std::cerr << "         --mtu:      optional: derive --slice-max-size from the network MTU so that each slice fits into one unfragmented datagram" << std::endl;
+        std::cerr << "         --fragment-size: optional: frames larger than this are published as several opendlv.proxy.ImageReadingFragment; default: " << (UDP_PAYLOAD_BUDGET - ENVELOPE_OVERHEAD) << std::endl;
+        std::cerr << "         --loss-recovery: optional: answer opendlv.proxy.ImageLossReport by no longer referring to the lost frames instead of sending a keyframe" << std::endl;
+        std::cerr << "         --fec:      optional: send this many opendlv.proxy.ImageReadingRepair in percent of the fragments of a frame to restore lost fragments (forward error correction); default: 0" << std::endl;
+        std::cerr << "         --min-keyframe-interval: optional: minimum time in ms between keyframes forced by opendlv.proxy.ImageKeyframeRequest (default = 1000)" << std::endl;
+        std::cerr << "         --zero-copy: send ImageReading with sendmsg directly from x264's buffer instead of through the OD4Session" << std::endl;
+        std::cerr << "         --send-only: only send to the OD4Session without joining it; disables opendlv.proxy.ImageEncoderControl and opendlv.proxy.ImageKeyframeRequest" << std::endl;
+        std::cerr << "         --batch:    send all slices or fragments of a frame with UDP segmentation offload or sendmmsg instead of one system call each" << std::endl;
+        std::cerr << "         --queue:    optional: publish from a separate thread that is fed by a queue of this many frames; 0 = publish on the encoding thread (default = 0)" << std::endl;
+        std::cerr << "         --drop:     optional: frames dropped from a full --queue: oldest, non-reference (non-reference frames first); default: oldest" << std::endl;
+        std::cerr << "         --unix-socket: optional: also serve all frames as length-prefixed Envelopes to clients of a SOCK_SEQPACKET Unix domain socket at this path" << std::endl;
+        std::cerr << "         --tcp-port: optional: also serve all frames as length-prefixed Envelopes to TCP clients on this port" << std::endl;
+        std::cerr << "         --client-queue: optional: Envelopes that may wait per --unix-socket or --tcp-port client before it is disconnected (default = 8)" << std::endl;
+        std::cerr << "         --output-ring: optional: also publish the encoded frames into a ring of records in the shared memory area of this name for consumers on the same host (see src/bitstream-ring.hpp)" << std::endl;
+        std::cerr << "         --output-ring-size: optional: size in MiB of the ring for --output-ring (default = 16)" << std::endl;
+        std::cerr << "         --record:   optional: also write the encoded frames to this file as Envelopes (.rec) or as raw h264 stream (.h264)" << std::endl;
+        std::cerr << "         --record-max-size: optional: start a new --record file at the next keyframe after this many MiB; 0 = never (default = 0)" << std::endl;
+        std::cerr << "         --record-max-duration: optional: start a new --record file at the next keyframe after this many seconds; 0 = never (default = 0)" << std::endl;
+        std::cerr << "         --rtp:      optional: also send the encoded frames as RTP (RFC 6184) to this unicast or multicast address; packets are limited by --mtu (default = 1500)" << std::endl;
+        std::cerr << "         --rtp-mode: optional: RTP packetization mode: 0 = single NAL units only, 1 = also STAP-A and FU-A (default = 1)" << std::endl;
+        std::cerr << "         --pacing:   optional: spread the datagrams of every frame over this percentage of the frame interval given by --fps; implies --queue=2 unless --queue is given" << std::endl;
+        std::cerr << "         --pacing-burst: optional: bytes of a frame sent back to back before --pacing starts (default = 8192)" << std::endl;
+        std::cerr << "         --pacing-mode: optional: auto (kernel if fq is the default queue discipline), kernel (SO_TXTIME or SO_MAX_PACING_RATE), or user (sleep before sending); default: auto" << std::endl;
+        std::cerr << "         --simulcast: optional: also encode the frames of a single --name at these sizes and bitrates on own threads and publish them with these senderStamps" << std::endl;
+        std::cerr << "         --frame-info: optional: send opendlv.proxy.ImageEncoderFrameInfo with frame type, pts/dts, rate factor, size, and latencies after every frame" << std::endl;
         std::cerr << "         --verbose:  print encoding information" << std::endl;
+        std::cerr << "         Bitrate, VBV, rate factor, GOP, and preset can be changed at runtime by sending opendlv.proxy.ImageEncoderControl with the camera's --id as senderStamp." << std::endl;
+        std::cerr << "         To encode several cameras in one process, pass comma-separated lists to --name, --width, --height, --id, and --format." << std::endl;
         std::cerr << "Example: " << argv[0] << " --cid=111 --name=data --width=640 --height=480 --verbose" << std::endl;
+        std::cerr << "         " << argv[0] << " --cid=111 --name=front,rear --width=1280,640 --height=720,480 --id=0,1" << std::endl;
     }
     else {
-        const std::string NAME{commandlineArguments["name"]};
-        const uint32_t WIDTH{static_cast<uint32_t>(std::stoi(commandlineArguments["width"]))};
-        const uint32_t HEIGHT{static_cast<uint32_t>(std::stoi(commandlineArguments["height"]))};
+        const std::vector<std::string> NAMES{valuesPerCamera(commandlineArguments["name"])};
+        const std::vector<std::string> WIDTHS{valuesPerCamera(commandlineArguments["width"])};
+        const std::vector<std::string> HEIGHTS{valuesPerCamera(commandlineArguments["height"])};
+        const std::vector<std::string> IDS{valuesPerCamera(commandlineArguments["id"])};
+        const std::vector<std::string> FORMATS{valuesPerCamera(commandlineArguments["format"])};
         const uint32_t GOP_DEFAULT{10};
         const uint32_t GOP{(commandlineArguments["gop"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["gop"])) : GOP_DEFAULT};
+        const bool INTRA_REFRESH{commandlineArguments.count("intra-refresh") != 0};
         const std::string PRESET{(commandlineArguments["preset"].size() != 0) ? commandlineArguments["preset"] : "veryfast"};
+        const bool RING{commandlineArguments.count("ring") != 0};
+        const bool SNAPSHOT{(commandlineArguments.count("snapshot") != 0) || RING};
+        const uint32_t FPS_DEFAULT{20};
+        const uint32_t FPS{(commandlineArguments["fps"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["fps"])) : FPS_DEFAULT};
+        const bool VFR{commandlineArguments.count("vfr") != 0};
+        const uint32_t THREADS{(commandlineArguments["threads"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["threads"])) : 1};
+        const std::string RC{commandlineArguments["rc"]};
+        const float CRF{(commandlineArguments["crf"].size() != 0) ? std::stof(commandlineArguments["crf"]) : 23.0f};
+        const uint32_t BITRATE{(commandlineArguments["bitrate"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["bitrate"])) : 0};
+        const uint32_t VBV_BUFSIZE{(commandlineArguments["vbv-bufsize"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["vbv-bufsize"])) : 0};
+        const bool CAPPED{commandlineArguments["max-frame-size"].size() != 0};
+        const uint32_t MAX_FRAME_SIZE{CAPPED ? static_cast<uint32_t>(std::stoi(commandlineArguments["max-frame-size"])) : (UDP_PAYLOAD_BUDGET - ENVELOPE_OVERHEAD)};
+        // The cap is enforced by x264's VBV, whose buffer makeParameters limits
+        // to one capped frame; without --vbv-maxrate, the buffer refills at
+        // --bitrate or, without one, by one capped frame per frame interval.
+        const uint32_t VBV_MAXRATE{(commandlineArguments["vbv-maxrate"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["vbv-maxrate"]))
+                                   : (CAPPED ? ((0 < BITRATE) ? BITRATE : MAX_FRAME_SIZE * 8 / 1000 * FPS) : 0)};
+        const uint32_t IP_AND_UDP_HEADERS{20 + 8};
+        const uint32_t MTU{(commandlineArguments["mtu"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["mtu"])) : 0};
+        const uint32_t SLICE_MAX_SIZE{(commandlineArguments["slice-max-size"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["slice-max-size"]))
+                                      : ((MTU > (IP_AND_UDP_HEADERS + ENVELOPE_OVERHEAD)) ? (MTU - IP_AND_UDP_HEADERS - ENVELOPE_OVERHEAD) : 0)};
+        const bool SLICED_THREADS{(commandlineArguments["sliced-threads"].size() != 0) ? (0 != std::stoi(commandlineArguments["sliced-threads"])) : true};
+        const uint32_t FRAGMENT_SIZE{(commandlineArguments["fragment-size"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["fragment-size"])) : (UDP_PAYLOAD_BUDGET - ENVELOPE_OVERHEAD)};
+        const bool LOSS_RECOVERY{commandlineArguments.count("loss-recovery") != 0};
+        const uint32_t FEC{(commandlineArguments["fec"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["fec"])) : 0};
+        const uint32_t MIN_KEYFRAME_INTERVAL{(commandlineArguments["min-keyframe-interval"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["min-keyframe-interval"])) : 1000};
+        const bool ZERO_COPY{commandlineArguments.count("zero-copy") != 0};
+        const bool SEND_ONLY{commandlineArguments.count("send-only") != 0};
+        const bool BATCH{commandlineArguments.count("batch") != 0};
+        const uint32_t QUEUE_SIZE{(commandlineArguments["queue"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["queue"])) : 0};
+        const std::string DROP{commandlineArguments["drop"]};
+        const std::string UNIX_SOCKET{commandlineArguments["unix-socket"]};
+        const std::string TCP_PORT{commandlineArguments["tcp-port"]};
+        const uint32_t CLIENT_QUEUE{(commandlineArguments["client-queue"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["client-queue"])) : 8};
+        const std::vector<std::string> OUTPUT_RINGS{valuesPerCamera(commandlineArguments["output-ring"])};
+        const uint32_t OUTPUT_RING_SIZE{(commandlineArguments["output-ring-size"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["output-ring-size"])) : 16};
+        const std::vector<std::string> RECORDS{valuesPerCamera(commandlineArguments["record"])};
+        const uint32_t RECORD_MAX_SIZE{(commandlineArguments["record-max-size"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["record-max-size"])) : 0};
+        const uint32_t RECORD_MAX_DURATION{(commandlineArguments["record-max-duration"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["record-max-duration"])) : 0};
+        const std::vector<std::string> RTPS{valuesPerCamera(commandlineArguments["rtp"])};
+        const bool RTP_SINGLE_NAL_UNIT{(commandlineArguments["rtp-mode"].size() != 0) && (0 == std::stoi(commandlineArguments["rtp-mode"]))};
+        const uint32_t PACING{(commandlineArguments["pacing"].size() != 0) ? std::min(static_cast<uint32_t>(std::stoi(commandlineArguments["pacing"])), 100u) : 0};
+        const uint32_t PACING_BURST{(commandlineArguments["pacing-burst"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["pacing-burst"])) : 8192};
+        const std::string PACING_MODE{commandlineArguments["pacing-mode"]};
+        const std::vector<std::string> SIMULCAST{valuesPerCamera(commandlineArguments["simulcast"])};
+        const bool FRAME_INFO{commandlineArguments.count("frame-info") != 0};
         const bool VERBOSE{commandlineArguments.count("verbose") != 0};
-        const uint32_t ID{(commandlineArguments["id"].size() != 0) ? static_cast<uint32_t>(std::stoi(commandlineArguments["id"])) : 0};
 
-        std::unique_ptr<cluon::SharedMemory> sharedMemory(new cluon::SharedMemory{NAME});
-        if (sharedMemory && sharedMemory->valid()) {
-            std::clog << "[opendlv-video-x264-encoder]: Attached to '" << sharedMemory->name() << "' (" << sharedMemory->size() << " bytes)." << std::endl;
+        RateControl rateControl{RateControl::PRESET};
+        if ("crf" == RC) {
+            rateControl = RateControl::CRF;
+        }
+        else if ("abr" == RC) {
+            rateControl = RateControl::ABR;
+        }
+        else if ("cbr" == RC) {
+            rateControl = RateControl::CBR;
+        }
+        else if (!RC.empty()) {
+            std::cerr << "[opendlv-video-x264-encoder]: Unknown rate control '" << RC << "'." << std::endl;
+            return 1;
+        }
+        if ( ((RateControl::ABR == rateControl) || (RateControl::CBR == rateControl)) && (0 == BITRATE) ) {
+            std::cerr << "[opendlv-video-x264-encoder]: --rc=" << RC << " requires --bitrate." << std::endl;
+            return 1;
+        }
+
+        uint16_t tcpPort{0};
+        if (!TCP_PORT.empty() && !parsePort(TCP_PORT, tcpPort)) {
+            std::cerr << "[opendlv-video-x264-encoder]: --tcp-port needs a port from 1 to 65535 instead of '" << TCP_PORT << "'." << std::endl;
+            return 1;
+        }
 
-            // Configure x264 parameters.
-            x264_param_t parameters;
-            if (0 != x264_param_default_preset(&parameters, PRESET.c_str(), "zerolatency")) {
-                std::cerr << "[opendlv-video-x264-encoder]: Failed to load preset parameters (" << PRESET << ", zerolatency) for x264." << std::endl;
+        bool pacingKernel{false};
+        if ("kernel" == PACING_MODE) {
+            pacingKernel = true;
+        }
+        else if (PACING_MODE.empty() || ("auto" == PACING_MODE)) {
+            pacingKernel = (0 < PACING) && fqIsDefaultQueueDiscipline();
+        }
+        else if ("user" != PACING_MODE) {
+            std::cerr << "[opendlv-video-x264-encoder]: Unknown pacing mode '" << PACING_MODE << "'." << std::endl;
+            return 1;
+        }
+
+        DropPolicy dropPolicy{DropPolicy::OLDEST};
+        if ("non-reference" == DROP) {
+            dropPolicy = DropPolicy::NON_REFERENCE;
+        }
+        else if (!DROP.empty() && ("oldest" != DROP)) {
+            std::cerr << "[opendlv-video-x264-encoder]: Unknown drop policy '" << DROP << "'." << std::endl;
+            return 1;
+        }
+
+        // Lists with a single entry apply to all cameras.
+        const std::size_t CAMERAS{NAMES.size()};
+        auto valueFor = [](const std::vector<std::string> &values, std::size_t i) {
+            return (1 == values.size()) ? values[0] : values[i];
+        };
+        for (const auto &values : {WIDTHS, HEIGHTS, FORMATS}) {
+            if ( (1 != values.size()) && (CAMERAS != values.size()) ) {
+                std::cerr << "[opendlv-video-x264-encoder]: --width, --height, and --format need either one value or one value per --name." << std::endl;
                 return 1;
             }
-            parameters.i_width  = WIDTH;
-            parameters.i_height = HEIGHT;
-            parameters.i_log_level = (VERBOSE ? X264_LOG_INFO : X264_LOG_NONE);
-            parameters.i_csp = X264_CSP_I420;
-            parameters.i_bitdepth = 8;
-            parameters.i_threads = 1;
-            parameters.i_keyint_min = GOP;
-            parameters.i_keyint_max = GOP;
-            parameters.i_fps_num = 20 /* implicitly derived from SharedMemory notifications */;
-            parameters.b_vfr_input = 0;
-            parameters.b_repeat_headers = 1;
-            parameters.b_annexb = 1;
-            if (0 != x264_param_apply_profile(&parameters, "baseline")) {
-                std::cerr << "[opendlv-video-x264-encoder]:Failed to apply parameters for x264." << std::endl;
+        }
+        // A single identifier would give all cameras the same senderStamp.
+        if ( (CAMERAS != IDS.size()) && !((1 == IDS.size()) && IDS[0].empty()) ) {
+            std::cerr << "[opendlv-video-x264-encoder]: --id needs one value per --name or none at all." << std::endl;
+            return 1;
+        }
+
+        // Every camera needs its own ring, file, and RTP destination.
+        for (const auto &values : {OUTPUT_RINGS, RECORDS, RTPS}) {
+            if ( (CAMERAS != values.size()) && !((1 == values.size()) && values[0].empty()) ) {
+                std::cerr << "[opendlv-video-x264-encoder]: --output-ring, --record, and --rtp need one value per --name." << std::endl;
                 return 1;
             }
+        }
 
-            // Initialize picture to pass YUV420 data into encoder.
-            x264_picture_t picture_in;
-            x264_picture_init(&picture_in);
-            picture_in.i_type = X264_TYPE_AUTO;
-            picture_in.img.i_csp = X264_CSP_I420;
-            picture_in.img.i_plane = HEIGHT;
-
-            // Directly point to the shared memory.
-            sharedMemory->lock();
-            {
-                picture_in.img.plane[0] = reinterpret_cast<uint8_t*>(sharedMemory->data());
-                picture_in.img.plane[1] = reinterpret_cast<uint8_t*>(sharedMemory->data() + (WIDTH * HEIGHT));
-                picture_in.img.plane[2] = reinterpret_cast<uint8_t*>(sharedMemory->data() + (WIDTH * HEIGHT + ((WIDTH * HEIGHT) >> 2)));
-                picture_in.img.i_stride[0] = WIDTH;
-                picture_in.img.i_stride[1] = WIDTH/2;
-                picture_in.img.i_stride[2] = WIDTH/2;
-                picture_in.img.i_stride[3] = 0;
+        std::vector<EncoderWorkerConfiguration> configurations;
+        for (std::size_t i{0}; i < CAMERAS; i++) {
+            EncoderWorkerConfiguration c;
+            c.name = NAMES[i];
+            c.width = static_cast<uint32_t>(std::stoi(valueFor(WIDTHS, i)));
+            c.height = static_cast<uint32_t>(std::stoi(valueFor(HEIGHTS, i)));
+            // Without explicit identifiers, cameras are distinguished by their position.
+            const std::string ID{valueFor(IDS, i)};
+            c.id = (ID.size() != 0) ? static_cast<uint32_t>(std::stoi(ID)) : static_cast<uint32_t>(i);
+            c.cid = static_cast<uint16_t>(std::stoi(commandlineArguments["cid"]));
+            c.gop = GOP;
+            c.intraRefresh = INTRA_REFRESH;
+            c.preset = PRESET;
+            c.formatName = (valueFor(FORMATS, i).size() != 0) ? valueFor(FORMATS, i) : "i420";
+            if (!parsePixelFormat(c.formatName, c.format)) {
+                std::cerr << "[opendlv-video-x264-encoder]: Unknown pixel format '" << c.formatName << "'." << std::endl;
+                return 1;
+            }
+            c.fps = FPS;
+            c.snapshot = SNAPSHOT;
+            c.ring = RING;
+            c.vfr = VFR;
+            c.zeroCopy = ZERO_COPY;
+            c.batch = BATCH;
+            c.frameInfo = FRAME_INFO;
+            // Pacing in user space sleeps on the publishing thread, which must
+            // not be the encoding thread; the kernel may also fall back to it.
+            c.queueSize = ((0 < PACING) && (0 == QUEUE_SIZE)) ? 2 : QUEUE_SIZE;
+            c.dropPolicy = dropPolicy;
+            c.outputRing = (CAMERAS == OUTPUT_RINGS.size()) ? OUTPUT_RINGS[i] : "";
+            c.outputRingSize = std::min(OUTPUT_RING_SIZE, 2047u) * 1024u * 1024u;
+            c.record = (CAMERAS == RECORDS.size()) ? RECORDS[i] : "";
+            c.recordMaxSize = static_cast<uint64_t>(RECORD_MAX_SIZE) * 1024 * 1024;
+            c.recordMaxDuration = RECORD_MAX_DURATION;
+            const std::string RTP{(CAMERAS == RTPS.size()) ? RTPS[i] : ""};
+            if (!RTP.empty()) {
+                const std::string::size_type COLON{RTP.rfind(':')};
+                uint16_t rtpPort{0};
+                if ( (std::string::npos == COLON) || !parsePort(RTP.substr(COLON + 1), rtpPort) ) {
+                    std::cerr << "[opendlv-video-x264-encoder]: --rtp needs <address>:<port> instead of '" << RTP << "'." << std::endl;
+                    return 1;
+                }
+                c.rtpAddress = RTP.substr(0, COLON);
+                c.rtpPort = rtpPort;
+                c.rtpMode = (RTP_SINGLE_NAL_UNIT ? RtpPacketizationMode::SINGLE_NAL_UNIT : RtpPacketizationMode::NON_INTERLEAVED);
             }
-            sharedMemory->unlock();
+            c.mtu = (0 < MTU) ? std::max(MTU, 256u) : 1500;
+            c.pacing = PACING;
+            c.pacingBurst = PACING_BURST;
+            c.pacingKernel = pacingKernel;
+            c.threads = THREADS;
+            c.slicedThreads = SLICED_THREADS;
+            c.rateControl = rateControl;
+            c.crf = CRF;
+            c.bitrate = BITRATE;
+            c.vbvMaxrate = VBV_MAXRATE;
+            c.vbvBufsize = VBV_BUFSIZE;
+            c.maxFrameSize = MAX_FRAME_SIZE;
+            c.sliceMaxSize = std::min(SLICE_MAX_SIZE, UDP_PAYLOAD_BUDGET - ENVELOPE_OVERHEAD);
+            c.fragmentSize = std::max(1u, std::min(FRAGMENT_SIZE, UDP_PAYLOAD_BUDGET - ENVELOPE_OVERHEAD));
+            c.fec = FEC;
+            c.lossRecovery = LOSS_RECOVERY;
+            c.minKeyframeInterval = MIN_KEYFRAME_INTERVAL;
+            c.verbose = VERBOSE;
+            configurations.push_back(c);
+        }
 
-            // Open h264 encoder.
-            x264_t *encoder = x264_encoder_open(&parameters);
-            if (nullptr == encoder) {
-                std::cerr << "[opendlv-video-x264-encoder]: Failed to open x264 encoder." << std::endl;
+        // Renditions of the same camera are scaled from the frame read once.
+        const std::size_t NUMBER_OF_CAMERAS{configurations.size()};
+        for (const auto &rendition : SIMULCAST) {
+            if (rendition.empty()) {
+                continue;
+            }
+            uint32_t width{0};
+            uint32_t height{0};
+            uint32_t bitrate{0};
+            uint32_t id{0};
+            if ( (1 != CAMERAS) || (4 != std::sscanf(rendition.c_str(), "%ux%u:%u:%u", &width, &height, &bitrate, &id))
+                 || (0 != (width % 2)) || (0 != (height % 2)) || (width > configurations[0].width) || (height > configurations[0].height) ) {
+                std::cerr << "[opendlv-video-x264-encoder]: --simulcast needs a single --name and <width>x<height>:<kbit/s>:<id> with even sizes up to the camera's instead of '" << rendition << "'." << std::endl;
                 return 1;
             }
+            EncoderWorkerConfiguration c{configurations[0]};
+            c.name = configurations[0].name + "@" + std::to_string(width) + "x" + std::to_string(height);
+            c.rendition = true;
+            c.width = width;
+            c.height = height;
+            c.id = id;
+            c.formatName = "i420";
+            c.format = PixelFormat::I420;
+            c.snapshot = false;
+            c.ring = false;
+            if (0 < bitrate) {
+                c.rateControl = RateControl::ABR;
+                c.bitrate = c.vbvMaxrate = c.vbvBufsize = bitrate;
+            }
+            c.outputRing = "";
+            c.record = "";
+            c.rtpAddress = "";
+            configurations.push_back(c);
+        }
 
-            cluon::data::TimeStamp before, after, sampleTimeStamp;
-
-            // Interface to a running OpenDaVINCI session (ignoring any incoming Envelopes).
-            cluon::OD4Session od4{static_cast<uint16_t>(std::stoi(commandlineArguments["cid"]))};
+        // Interface to a running OpenDaVINCI session; it is shared among all
+        // encoding threads as sending is thread-safe. In send-only mode, the
+        // workers send on their own and nothing is received from the session.
+        std::unique_ptr<cluon::OD4Session> od4{nullptr};
+        if (!SEND_ONLY) {
+            od4.reset(new cluon::OD4Session{static_cast<uint16_t>(std::stoi(commandlineArguments["cid"]))});
+        }
 
-            int i_frame{0};
-            while ( (sharedMemory && sharedMemory->valid()) && od4.isRunning() ) {
-                // Wait for incoming frame.
-                sharedMemory->wait();
+        // Local and bulk consumers may connect to stream sockets, which are
+        // shared among all cameras and must outlive the workers.
+        std::vector<std::unique_ptr<StreamServer>> streamServers;
+        if (!UNIX_SOCKET.empty()) {
+            streamServers.emplace_back(new StreamServer(UNIX_SOCKET, std::max(1u, CLIENT_QUEUE)));
+            if (!streamServers.back()->valid()) {
+                std::cerr << "[opendlv-video-x264-encoder]: Failed to listen on '" << UNIX_SOCKET << "'." << std::endl;
+                return 1;
+            }
+        }
+        if (0 < tcpPort) {
+            streamServers.emplace_back(new StreamServer(tcpPort, std::max(1u, CLIENT_QUEUE)));
+            if (!streamServers.back()->valid()) {
+                std::cerr << "[opendlv-video-x264-encoder]: Failed to listen on TCP port " << TCP_PORT << "." << std::endl;
+                return 1;
+            }
+        }
 
-                sampleTimeStamp = cluon::time::now();
+        // Workers are stopped in this order, so the cameras come before their renditions.
+        std::vector<std::unique_ptr<EncoderWorker>> workers;
+        for (auto &c : configurations) {
+            workers.emplace_back(new EncoderWorker(c, od4.get()));
+        }
+        for (std::size_t i{NUMBER_OF_CAMERAS}; i < workers.size(); i++) {
+            workers[0]->addRendition(workers[i].get());
+        }
+        for (auto &w : workers) {
+            if (!w->open()) {
+                return 1;
+            }
+            for (auto &server : streamServers) {
+                w->addStreamServer(server.get());
+            }
+        }
+        for (auto &w : workers) {
+            w->start();
+        }
 
-                std::string data;
-                sharedMemory->lock();
-                {
-                    // Read notification timestamp.
-                    auto r = sharedMemory->getTimeStamp();
-                    sampleTimeStamp = (r.first ? r.second : sampleTimeStamp);
-                }
-                {
-                    if (VERBOSE) {
-                        before = cluon::time::now();
+        // Settings can be changed at runtime; the senderStamp selects the camera.
+        if (od4) {
+            od4->dataTrigger(opendlv::proxy::ImageEncoderControl::ID(), [&workers](cluon::data::Envelope &&envelope) {
+                const uint32_t SENDER_STAMP{envelope.senderStamp()};
+                const auto CONTROL{cluon::extractMessage<opendlv::proxy::ImageEncoderControl>(std::move(envelope))};
+                for (auto &w : workers) {
+                    if (SENDER_STAMP == w->configuration().id) {
+                        w->control(CONTROL);
                     }
-                    x264_nal_t *nals{nullptr};
-                    int i_nals{0};
-                    picture_in.i_pts = i_frame++;
-                    x264_picture_t picture_out;
-                    int frameSize{x264_encoder_encode(encoder, &nals, &i_nals, &picture_in, &picture_out)};
-                    if (0 < frameSize) {
-                        data = std::string(reinterpret_cast<char*>(nals->p_payload), frameSize);
+                }
+            });
+            od4->dataTrigger(opendlv::proxy::ImageKeyframeRequest::ID(), [&workers](cluon::data::Envelope &&envelope) {
+                for (auto &w : workers) {
+                    if (envelope.senderStamp() == w->configuration().id) {
+                        w->requestKeyframe();
                     }
-                    if (VERBOSE) {
-                        after = cluon::time::now();
+                }
+            });
+            od4->dataTrigger(opendlv::proxy::ImageLossReport::ID(), [&workers](cluon::data::Envelope &&envelope) {
+                const uint32_t SENDER_STAMP{envelope.senderStamp()};
+                const auto REPORT{cluon::extractMessage<opendlv::proxy::ImageLossReport>(std::move(envelope))};
+                for (auto &w : workers) {
+                    if (SENDER_STAMP == w->configuration().id) {
+                        w->reportLoss(REPORT);
                     }
                 }
-                sharedMemory->unlock();
+            });
+        }
 
-                if (!data.empty()) {
-                    opendlv::proxy::ImageReading ir;
-                    ir.fourcc("h264").width(WIDTH).height(HEIGHT).data(data);
-                    od4.send(ir, sampleTimeStamp, ID);
+        // Report the throughput per camera and for the whole process.
+        const std::chrono::seconds REPORTING_INTERVAL{5};
+        std::vector<EncoderWorkerStatistics> lastStatistics(workers.size());
+        auto lastReport{std::chrono::steady_clock::now()};
+        double lastCpuSeconds{cpuSeconds()};
+        bool anyRunning{true};
+        while ((!od4 || od4->isRunning()) && anyRunning) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            anyRunning = false;
+            for (auto &w : workers) {
+                anyRunning |= w->isRunning();
+            }
 
-                    if (VERBOSE) {
-                        std::clog << "[opendlv-video-x264-encoder]: Frame size = " << data.size() << " bytes; sample time = " << cluon::time::toMicroseconds(sampleTimeStamp) << " microseconds; encoding took " << cluon::time::deltaInMicroseconds(after, before) << " microseconds." << std::endl;
+            const auto NOW{std::chrono::steady_clock::now()};
+            if (VERBOSE && ((NOW - lastReport) >= REPORTING_INTERVAL)) {
+                const double SECONDS{std::chrono::duration<double>(NOW - lastReport).count()};
+                double totalFps{0.0};
+                double totalKbps{0.0};
+                uint64_t totalEncodingMicroseconds{0};
+                for (std::size_t i{0}; i < workers.size(); i++) {
+                    const EncoderWorkerStatistics CURRENT{workers[i]->statistics()};
+                    const EncoderWorkerStatistics &LAST{lastStatistics[i]};
+                    const uint64_t FRAMES{CURRENT.frames - LAST.frames};
+                    const uint64_t NEAR_CAP{CURRENT.framesNearCap - LAST.framesNearCap};
+                    const double FPS_MEASURED{static_cast<double>(FRAMES) / SECONDS};
+                    const double KBPS{static_cast<double>(CURRENT.bytes - LAST.bytes) * 8.0 / 1000.0 / SECONDS};
+                    std::clog << "[opendlv-video-x264-encoder]: '" << workers[i]->configuration().name << "': " << FPS_MEASURED << " fps, " << KBPS << " kbit/s";
+                    if (0 < FRAMES) {
+                        std::clog << "; encoding took " << (static_cast<double>(CURRENT.encodingMicroseconds - LAST.encodingMicroseconds) / static_cast<double>(FRAMES)) << " microseconds per frame";
+                        if (CURRENT.scalingMicroseconds > LAST.scalingMicroseconds) {
+                            std::clog << ", scaling renditions " << (static_cast<double>(CURRENT.scalingMicroseconds - LAST.scalingMicroseconds) / static_cast<double>(FRAMES)) << " microseconds per frame";
+                        }
+                        if (workers[i]->configuration().rendition) {
+                            std::clog << ", " << (CURRENT.skippedFrames - LAST.skippedFrames) << " frame(s) skipped while busy";
+                        }
+                        std::clog << "; publishing took " << (static_cast<double>(CURRENT.publishingMicroseconds - LAST.publishingMicroseconds) / static_cast<double>(FRAMES)) << " microseconds per frame"
+                                  << " (" << (CURRENT.datagrams - LAST.datagrams) << " datagram(s) in " << (CURRENT.systemCalls - LAST.systemCalls) << " system call(s))";
+                        // The spread of the frame sizes and the largest frame show how bursty the stream is,
+                        // e.g., to compare periodic IDR frames against --intra-refresh.
+                        const double MEAN{static_cast<double>(CURRENT.bytes - LAST.bytes) / static_cast<double>(FRAMES)};
+                        const double VARIANCE{std::max(0.0, (CURRENT.bytesSquaredSum - LAST.bytesSquaredSum) / static_cast<double>(FRAMES) - MEAN * MEAN)};
+                        std::clog << "; frame size " << MEAN << " +/- " << std::sqrt(VARIANCE) << " bytes, peak " << CURRENT.peakFrameSize << " bytes";
+                        // Frames close to the cap were most likely squeezed by the VBV; comparing their
+                        // rate factor with the average shows the quality that the cap costs.
+                        std::clog << "; " << (CURRENT.framesAboveCap - LAST.framesAboveCap) << " frame(s) above and " << NEAR_CAP << " near the cap of " << workers[i]->configuration().maxFrameSize << " bytes"
+                                  << "; average rate factor " << ((CURRENT.rateFactorSum - LAST.rateFactorSum) / static_cast<double>(FRAMES));
+                        if (0 < NEAR_CAP) {
+                            std::clog << " (" << ((CURRENT.rateFactorSumNearCap - LAST.rateFactorSumNearCap) / static_cast<double>(NEAR_CAP)) << " near the cap)";
+                        }
+                        std::clog << "; " << (CURRENT.fragmentedFrames - LAST.fragmentedFrames) << " frame(s) fragmented";
+                        if (0 < workers[i]->configuration().fec) {
+                            const uint64_t FRAGMENTED{CURRENT.fragmentedFrames - LAST.fragmentedFrames};
+                            std::clog << " with " << (CURRENT.repairDatagrams - LAST.repairDatagrams) << " repair datagram(s)";
+                            if (0 < FRAGMENTED) {
+                                std::clog << " computed in " << (static_cast<double>(CURRENT.repairMicroseconds - LAST.repairMicroseconds) / static_cast<double>(FRAGMENTED)) << " microseconds per frame";
+                            }
+                            std::clog << ", " << (CURRENT.unprotectedFrames - LAST.unprotectedFrames) << " with too many fragments to protect";
+                        }
+                        if (0 < workers[i]->configuration().queueSize) {
+                            std::clog << "; queue depth " << CURRENT.queueDepth << " (peak " << CURRENT.peakQueueDepth << ") of " << workers[i]->configuration().queueSize << " frame(s), " << (CURRENT.droppedFrames - LAST.droppedFrames) << " frame(s) dropped (" << (CURRENT.droppedReferenceFrames - LAST.droppedReferenceFrames) << " reference)";
+                        }
+                        if (!workers[i]->configuration().outputRing.empty()) {
+                            const uint64_t RING_FRAMES{CURRENT.outputRingFrames - LAST.outputRingFrames};
+                            std::clog << "; " << RING_FRAMES << " frame(s) into '" << workers[i]->configuration().outputRing << "'";
+                            if (0 < RING_FRAMES) {
+                                std::clog << " at " << (static_cast<double>(CURRENT.outputRingMicroseconds - LAST.outputRingMicroseconds) / static_cast<double>(RING_FRAMES)) << " microseconds per frame";
+                            }
+                            std::clog << ", " << (CURRENT.outputRingOversized - LAST.outputRingOversized) << " too large";
+                        }
+                        if (!workers[i]->configuration().record.empty()) {
+                            std::clog << "; " << ((CURRENT.recordedBytes - LAST.recordedBytes) / 1024) << " KiB recorded into " << CURRENT.recordFiles << " file(s), " << (CURRENT.recordDroppedFrames - LAST.recordDroppedFrames) << " frame(s) dropped";
+                        }
+                        if (!workers[i]->configuration().rtpAddress.empty()) {
+                            std::clog << "; " << (CURRENT.rtpPackets - LAST.rtpPackets) << " RTP packet(s), " << (CURRENT.rtpOversized - LAST.rtpOversized) << " NAL unit(s) too large";
+                        }
+                        if (0 < workers[i]->configuration().pacing) {
+                            const uint64_t PACED{CURRENT.pacedDatagrams - LAST.pacedDatagrams};
+                            std::clog << "; " << PACED << " datagram(s) paced";
+                            if (0 < PACED) {
+                                std::clog << " with " << (static_cast<double>(CURRENT.pacingDelayMicroseconds - LAST.pacingDelayMicroseconds) / static_cast<double>(PACED)) << " microseconds queueing delay on average";
+                            }
+                            std::clog << " (peak " << CURRENT.pacingPeakDelayMicroseconds << " microseconds), peak burst " << CURRENT.pacingPeakBurst << " bytes, " << (CURRENT.pacingDropped - LAST.pacingDropped) << " dropped";
+                        }
+                        std::clog << "; " << (CURRENT.forcedKeyframes - LAST.forcedKeyframes) << " keyframe(s) forced for " << (CURRENT.keyframeRequests - LAST.keyframeRequests) << " request(s)";
+                        const uint64_t RECOVERIES{CURRENT.recoveryFrames - LAST.recoveryFrames};
+                        if (0 < RECOVERIES) {
+                            // Bytes and time to recover compare invalidated references against keyframes.
+                            std::clog << "; " << (CURRENT.lossReports - LAST.lossReports) << " loss report(s), " << (CURRENT.invalidations - LAST.invalidations) << " answered by invalidating references"
+                                      << ", recovery frames of " << (static_cast<double>(CURRENT.recoveryBytes - LAST.recoveryBytes) / static_cast<double>(RECOVERIES)) << " bytes"
+                                      << " published " << (static_cast<double>(CURRENT.recoveryMicroseconds - LAST.recoveryMicroseconds) / static_cast<double>(RECOVERIES)) << " microseconds after the report on average";
+                        }
                     }
+                    std::clog << "." << std::endl;
+                    totalFps += FPS_MEASURED;
+                    totalKbps += KBPS;
+                    totalEncodingMicroseconds += CURRENT.encodingMicroseconds - LAST.encodingMicroseconds;
+                    lastStatistics[i] = CURRENT;
                 }
+                // CPU time of all threads of the process, e.g., to compare --send-only.
+                const double CPU_SECONDS{cpuSeconds()};
+                // Number of encoders inside x264_encoder_encode at the same time on
+                // average, e.g., to see how renditions scale across cores.
+                std::clog << "[opendlv-video-x264-encoder]: Total: " << totalFps << " fps, " << totalKbps << " kbit/s from " << workers.size() << " camera(s) and rendition(s); " << (static_cast<double>(totalEncodingMicroseconds) / (SECONDS * 1000.0 * 1000.0)) << " encoder(s) busy on average; CPU usage " << (100.0 * (CPU_SECONDS - lastCpuSeconds) / SECONDS) << "% of one core";
+                if (0.0 < totalKbps) {
+                    std::clog << " (" << (1000.0 * (CPU_SECONDS - lastCpuSeconds) / (totalKbps * SECONDS / 1000.0)) << " ms CPU time per Mbit)";
+                }
+                for (auto &server : streamServers) {
+                    std::clog << "; " << server->clients() << " stream client(s), " << server->droppedClients() << " dropped as too slow";
+                }
+                std::clog << "." << std::endl;
+                lastCpuSeconds = CPU_SECONDS;
+                lastReport = NOW;
             }
+        }
 
-            x264_encoder_close(encoder);
-            retCode = 0;
+        if (od4) {
+            od4->dataTrigger(opendlv::proxy::ImageEncoderControl::ID(), nullptr);
+            od4->dataTrigger(opendlv::proxy::ImageKeyframeRequest::ID(), nullptr);
+            od4->dataTrigger(opendlv::proxy::ImageLossReport::ID(), nullptr);
         }
-        else {
-            std::cerr << "[opendlv-video-x264-encoder]: Failed to attach to shared memory '" << NAME << "'." << std::endl;
+        // The sending threads may still publish through od4 until stopped;
+        // afterwards, od4 ends its receiving thread before the workers are
+        // destroyed so that no trigger can reach them anymore.
+        for (auto &w : workers) {
+            w->stop();
         }
+        od4.reset();
+        retCode = 0;
     }
     return retCode;
 }
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "pacer.hpp"
+
+#include <time.h>
+
+#include <algorithm>
+
+Pacer::Pacer(uint32_t burstSize) noexcept
+    : m_burstSize{static_cast<double>(std::max(burstSize, 1u))}
+    , m_tokens{m_burstSize} {}
+
+int64_t Pacer::now() noexcept {
+    struct timespec ts{};
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<int64_t>(ts.tv_sec) * 1000 * 1000 * 1000 + static_cast<int64_t>(ts.tv_nsec);
+}
+
+void Pacer::startFrame(uint64_t bytes, int64_t windowInMicroseconds) noexcept {
+    // The rate covers the whole frame, so that small frames that fit into
+    // the burst do not set a rate that barely refills the bucket; every frame
+    // starts with a full bucket so that neither the debt of a large frame nor
+    // a starved bucket is carried over to the next one.
+    const double BYTES{std::max(1.0, static_cast<double>(bytes))};
+    m_bytesPerNanosecond = BYTES / (static_cast<double>(std::max<int64_t>(1, windowInMicroseconds)) * 1000.0);
+    m_tokens = m_burstSize;
+}
+
+int64_t Pacer::departure(uint32_t bytes, int64_t now) noexcept {
+    if (0.0 >= m_bytesPerNanosecond) {
+        return now;
+    }
+    int64_t t{std::max(now, m_time)};
+    m_tokens = std::min(m_burstSize, m_tokens + static_cast<double>(t - m_time) * m_bytesPerNanosecond);
+    // A datagram larger than the bucket waits for a full bucket and leaves
+    // the bucket in debt by the rest of its size, which delays the next ones.
+    const double NEEDED{std::min(static_cast<double>(bytes), m_burstSize)};
+    if (m_tokens < NEEDED) {
+        t += static_cast<int64_t>((NEEDED - m_tokens) / m_bytesPerNanosecond) + 1;
+        m_tokens = NEEDED;
+    }
+    m_tokens -= static_cast<double>(bytes);
+
+    m_burst = (t == m_time) ? (m_burst + bytes) : bytes;
+    m_time = t;
+    m_peakBurst = std::max(m_peakBurst, m_burst);
+
+    const uint64_t DELAY{static_cast<uint64_t>(t - now)};
+    m_datagrams++;
+    m_delayNanoseconds += DELAY;
+    m_peakDelayNanoseconds = std::max(m_peakDelayNanoseconds, DELAY);
+    return t;
+}
+
+void Pacer::dropped(uint64_t datagrams) noexcept {
+    m_dropped += datagrams;
+}
+
+uint64_t Pacer::rate() const noexcept {
+    return static_cast<uint64_t>(m_bytesPerNanosecond * 1000.0 * 1000.0 * 1000.0);
+}
+
+uint64_t Pacer::datagrams() const noexcept {
+    return m_datagrams;
+}
+
+uint64_t Pacer::delayMicroseconds() const noexcept {
+    return m_delayNanoseconds / 1000;
+}
+
+uint64_t Pacer::peakDelayMicroseconds() const noexcept {
+    return m_peakDelayNanoseconds / 1000;
+}
+
+uint64_t Pacer::peakBurst() const noexcept {
+    return m_peakBurst;
+}
+
+uint64_t Pacer::dropped() const noexcept {
+    return m_dropped;
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef PACER_HPP
+#define PACER_HPP
+
+#include <cstdint>
+
+/**
+ * How the departure times of a Pacer are enforced: TXTIME hands them to the
+ * kernel with every datagram (SO_TXTIME), MAX_PACING_RATE lets the kernel
+ * send at the pacer's rate (SO_MAX_PACING_RATE), and USER_SPACE sleeps until
+ * the departure time before every send; the kernel methods need the fq queue
+ * discipline on the outgoing interface.
+ */
+enum class PacingMode {
+    USER_SPACE,
+    MAX_PACING_RATE,
+    TXTIME,
+};
+
+/**
+ * This class is a token bucket that spreads the datagrams of a frame over a
+ * window, e.g., a part of the frame interval, so that a large I-frame does
+ * not leave the host as one burst: every frame starts with a full bucket, so
+ * up to burstSize bytes depart at once, and the remaining bytes follow at the
+ * rate that would send the whole frame within the window.
+ *
+ * Times are nanoseconds of CLOCK_MONOTONIC as expected by SO_TXTIME with the
+ * fq queue discipline.
+ *
+ * The class is not thread-safe; every sender uses its own instance.
+ */
+class Pacer {
+   private:
+    Pacer(const Pacer &) = delete;
+    Pacer(Pacer &&)      = delete;
+    Pacer &operator=(const Pacer &) = delete;
+    Pacer &operator=(Pacer &&) = delete;
+
+   public:
+    /**
+     * @param burstSize Bytes that may depart back to back.
+     */
+    explicit Pacer(uint32_t burstSize) noexcept;
+
+    /**
+     * @return Current time in nanoseconds of CLOCK_MONOTONIC.
+     */
+    static int64_t now() noexcept;
+
+    /**
+     * This method sets the rate for the datagrams of the next frame and
+     * refills the bucket.
+     *
+     * @param bytes Size of all datagrams of the frame.
+     * @param windowInMicroseconds Time to spread the frame over.
+     */
+    void startFrame(uint64_t bytes, int64_t windowInMicroseconds) noexcept;
+
+    /**
+     * This method takes the tokens for one datagram from the bucket.
+     *
+     * @param bytes Size of the datagram.
+     * @param now Time at which the datagram was handed over for sending.
+     * @return Departure time of the datagram.
+     */
+    int64_t departure(uint32_t bytes, int64_t now) noexcept;
+
+    /**
+     * This method counts datagrams that the kernel did not send.
+     */
+    void dropped(uint64_t datagrams) noexcept;
+
+    /**
+     * @return Rate of the current frame in bytes per second.
+     */
+    uint64_t rate() const noexcept;
+
+    /**
+     * @return Number of datagrams scheduled so far.
+     */
+    uint64_t datagrams() const noexcept;
+
+    /**
+     * @return Sum of the queueing delays of all datagrams in microseconds,
+     *         i.e., the time between handing over and departure.
+     */
+    uint64_t delayMicroseconds() const noexcept;
+
+    /**
+     * @return Largest queueing delay of a datagram in microseconds.
+     */
+    uint64_t peakDelayMicroseconds() const noexcept;
+
+    /**
+     * @return Largest number of bytes that departed back to back.
+     */
+    uint64_t peakBurst() const noexcept;
+
+    /**
+     * @return Number of datagrams that the kernel did not send.
+     */
+    uint64_t dropped() const noexcept;
+
+   private:
+    const double m_burstSize;
+    double m_bytesPerNanosecond{0.0};
+    double m_tokens{0.0};
+    int64_t m_time{0};           // time of m_tokens and of the last departure
+    uint64_t m_burst{0};         // bytes departing at m_time
+
+    uint64_t m_datagrams{0};
+    uint64_t m_delayNanoseconds{0};
+    uint64_t m_peakDelayNanoseconds{0};
+    uint64_t m_peakBurst{0};
+    uint64_t m_dropped{0};
+};
+
+#endif
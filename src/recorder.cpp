@@ -0,0 +1,217 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "recorder.hpp"
+#include "envelope-sender.hpp"
+#include "opendlv-standard-message-set.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+// Writes are issued in multiples of the page size from a buffer of this size.
+constexpr std::size_t WRITE_SIZE{4 * 1024 * 1024};
+constexpr std::size_t WRITE_ALIGNMENT{4096};
+
+static bool endsWith(const std::string &s, const std::string &suffix) noexcept {
+    return (s.size() >= suffix.size()) && (0 == s.compare(s.size() - suffix.size(), suffix.size(), suffix));
+}
+
+Recorder::Recorder(const std::string &fileName, uint32_t width, uint32_t height, uint32_t senderStamp,
+                   uint64_t maxFileSize, uint32_t maxDuration, uint64_t maxQueuedBytes) noexcept
+    : m_fileName{fileName}
+    , m_rawStream{endsWith(fileName, ".h264") || endsWith(fileName, ".264")}
+    , m_width{width}
+    , m_height{height}
+    , m_senderStamp{senderStamp}
+    , m_maxFileSize{maxFileSize}
+    , m_maxDuration{maxDuration}
+    , m_maxQueuedBytes{maxQueuedBytes} {
+    m_buffer.resize(2 * WRITE_SIZE);
+    if (openFile()) {
+        m_thread = std::thread(&Recorder::run, this);
+    }
+}
+
+Recorder::~Recorder() noexcept {
+    {
+        std::lock_guard<std::mutex> lck(m_mutex);
+        m_stop = true;
+    }
+    m_condition.notify_one();
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+    closeFile();
+}
+
+bool Recorder::valid() const noexcept {
+    return !m_failed.load();
+}
+
+uint64_t Recorder::bytesWritten() noexcept {
+    std::lock_guard<std::mutex> lck(m_mutex);
+    return m_bytesWritten;
+}
+
+uint64_t Recorder::droppedFrames() noexcept {
+    std::lock_guard<std::mutex> lck(m_mutex);
+    return m_droppedFrames;
+}
+
+uint32_t Recorder::files() noexcept {
+    std::lock_guard<std::mutex> lck(m_mutex);
+    return m_files;
+}
+
+void Recorder::record(const uint8_t *data, uint32_t size, const cluon::data::TimeStamp &sampleTimeStamp, bool keyframe) noexcept {
+    if (m_failed.load()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lck(m_mutex);
+        // After a dropped frame, the following frames cannot be decoded
+        // before the next keyframe.
+        if (m_waitForKeyframe && !keyframe) {
+            m_droppedFrames++;
+            return;
+        }
+        if (m_queuedBytes + size > m_maxQueuedBytes) {
+            m_waitForKeyframe = true;
+            m_droppedFrames++;
+            return;
+        }
+        m_waitForKeyframe = false;
+        m_queuedBytes += size;
+        m_frames.emplace_back();
+        Frame &frame{m_frames.back()};
+        frame.data.assign(reinterpret_cast<const char*>(data), size);
+        frame.sampleTimeStamp = sampleTimeStamp;
+        frame.keyframe = keyframe;
+    }
+    m_condition.notify_one();
+}
+
+bool Recorder::openFile() noexcept {
+    std::string fileName{m_fileName};
+    if ( (0 < m_maxFileSize) || (0 < m_maxDuration) ) {
+        // Number the files before the extension.
+        char number[16];
+        std::snprintf(number, sizeof(number), "-%04u", m_files);
+        const std::string::size_type DOT{fileName.rfind('.')};
+        const std::string::size_type SLASH{fileName.rfind('/')};
+        const bool HAS_EXTENSION{(std::string::npos != DOT) && ((std::string::npos == SLASH) || (DOT > SLASH))};
+        fileName.insert(HAS_EXTENSION ? DOT : fileName.size(), number);
+    }
+    m_file = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_file < 0) {
+        std::cerr << "[opendlv-video-x264-encoder/recorder]: Failed to create '" << fileName << "': " << std::strerror(errno) << std::endl;
+        m_failed.store(true);
+        return false;
+    }
+    m_fileSize = 0;
+    m_fileHasFrames = false;
+    std::lock_guard<std::mutex> lck(m_mutex);
+    m_files++;
+    return true;
+}
+
+void Recorder::closeFile() noexcept {
+    if (!(m_file < 0)) {
+        write(true);
+        ::close(m_file);
+        m_file = -1;
+    }
+}
+
+void Recorder::write(bool all) noexcept {
+    // Except for the end of a file, only whole pages are written.
+    const std::size_t LENGTH{all ? m_buffered : (m_buffered / WRITE_ALIGNMENT) * WRITE_ALIGNMENT};
+    std::size_t written{0};
+    while (written < LENGTH) {
+        const ssize_t RESULT{::write(m_file, m_buffer.data() + written, LENGTH - written)};
+        if (RESULT < 0) {
+            if (EINTR == errno) {
+                continue;
+            }
+            std::cerr << "[opendlv-video-x264-encoder/recorder]: Failed to write: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        written += static_cast<std::size_t>(RESULT);
+    }
+    std::memmove(m_buffer.data(), m_buffer.data() + LENGTH, m_buffered - LENGTH);
+    m_buffered -= LENGTH;
+    std::lock_guard<std::mutex> lck(m_mutex);
+    m_bytesWritten += written;
+}
+
+void Recorder::run() noexcept {
+    Frame frame;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lck(m_mutex);
+            m_condition.wait(lck, [this]() { return m_stop || !m_frames.empty(); });
+            if (m_frames.empty()) {
+                // m_stop is set and all frames are written.
+                break;
+            }
+            frame = std::move(m_frames.front());
+            m_frames.pop_front();
+            m_queuedBytes -= frame.data.size();
+        }
+
+        const int64_t SAMPLE_TIME{cluon::time::toMicroseconds(frame.sampleTimeStamp)};
+        if (m_fileHasFrames && frame.keyframe) {
+            const bool TOO_LARGE{(0 < m_maxFileSize) && (m_fileSize >= m_maxFileSize)};
+            const bool TOO_LONG{(0 < m_maxDuration) && ((SAMPLE_TIME - m_fileStartInMicroseconds) >= static_cast<int64_t>(m_maxDuration) * 1000 * 1000)};
+            if (TOO_LARGE || TOO_LONG) {
+                closeFile();
+                if (!openFile()) {
+                    break;
+                }
+            }
+        }
+        if (!m_fileHasFrames) {
+            m_fileStartInMicroseconds = SAMPLE_TIME;
+            m_fileHasFrames = true;
+        }
+
+        std::string envelope;
+        if (!m_rawStream) {
+            opendlv::proxy::ImageReading ir;
+            ir.fourcc("h264").width(m_width).height(m_height).data(std::move(frame.data));
+            envelope = EnvelopeSender::serialize(ir, frame.sampleTimeStamp, m_senderStamp);
+        }
+        const std::string &BYTES{m_rawStream ? frame.data : envelope};
+        std::size_t offset{0};
+        while (offset < BYTES.size()) {
+            const std::size_t LENGTH{std::min(BYTES.size() - offset, m_buffer.size() - m_buffered)};
+            std::memcpy(m_buffer.data() + m_buffered, BYTES.data() + offset, LENGTH);
+            m_buffered += LENGTH;
+            offset += LENGTH;
+            if (m_buffered >= WRITE_SIZE) {
+                write(false);
+            }
+        }
+        m_fileSize += BYTES.size();
+    }
+}
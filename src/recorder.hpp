@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RECORDER_HPP
+#define RECORDER_HPP
+
+#include "cluon-complete.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * This class writes encoded frames to disk, either as Envelopes with
+ * opendlv::proxy::ImageReading like a cluon recorder (.rec) or as raw h264
+ * Annex-B stream (.h264); the format is chosen by the file name's extension.
+ *
+ * record() only copies the frame into a queue; a background thread gathers
+ * the frames into large buffers that are written in multiples of 4 KiB. When
+ * more than maxQueuedBytes are waiting because the disk is too slow, frames
+ * are dropped until the next keyframe instead of stalling the caller.
+ *
+ * Files are rotated at the first keyframe after a file exceeds maxFileSize
+ * bytes or maxDuration seconds of sample time, so that every file starts
+ * with a keyframe; rotated files are numbered, e.g., front-0000.rec,
+ * front-0001.rec, etc.
+ */
+class Recorder {
+   private:
+    Recorder(const Recorder &) = delete;
+    Recorder(Recorder &&)      = delete;
+    Recorder &operator=(const Recorder &) = delete;
+    Recorder &operator=(Recorder &&) = delete;
+
+   public:
+    /**
+     * @param fileName File to record to.
+     * @param width Width of the frames for ImageReading.
+     * @param height Height of the frames for ImageReading.
+     * @param senderStamp senderStamp of the Envelopes.
+     * @param maxFileSize Bytes after which a new file is started; 0 = never.
+     * @param maxDuration Seconds after which a new file is started; 0 = never.
+     * @param maxQueuedBytes Bytes that may wait for the background thread.
+     */
+    Recorder(const std::string &fileName, uint32_t width, uint32_t height, uint32_t senderStamp,
+             uint64_t maxFileSize, uint32_t maxDuration, uint64_t maxQueuedBytes) noexcept;
+    ~Recorder() noexcept;
+
+    /**
+     * @return true if all files so far could be created.
+     */
+    bool valid() const noexcept;
+
+    /**
+     * This method queues an encoded frame for writing; it never blocks on
+     * the disk.
+     */
+    void record(const uint8_t *data, uint32_t size, const cluon::data::TimeStamp &sampleTimeStamp, bool keyframe) noexcept;
+
+    /**
+     * @return Number of bytes written to disk so far.
+     */
+    uint64_t bytesWritten() noexcept;
+
+    /**
+     * @return Number of frames dropped because the disk was too slow.
+     */
+    uint64_t droppedFrames() noexcept;
+
+    /**
+     * @return Number of files started so far.
+     */
+    uint32_t files() noexcept;
+
+   private:
+    struct Frame {
+        std::string data{};
+        cluon::data::TimeStamp sampleTimeStamp{};
+        bool keyframe{false};
+    };
+
+    void run() noexcept;
+    bool openFile() noexcept;
+    void closeFile() noexcept;
+    void write(bool all) noexcept;
+
+   private:
+    const std::string m_fileName;
+    const bool m_rawStream;
+    const uint32_t m_width;
+    const uint32_t m_height;
+    const uint32_t m_senderStamp;
+    const uint64_t m_maxFileSize;
+    const uint32_t m_maxDuration;
+    const uint64_t m_maxQueuedBytes;
+
+    // Only used by the background thread once it runs.
+    int32_t m_file{-1};
+    uint64_t m_fileSize{0};
+    int64_t m_fileStartInMicroseconds{0};
+    bool m_fileHasFrames{false};
+    std::vector<uint8_t> m_buffer{};
+    std::size_t m_buffered{0};
+
+    std::mutex m_mutex{};
+    std::condition_variable m_condition{};
+    std::deque<Frame> m_frames{};
+    uint64_t m_queuedBytes{0};
+    bool m_waitForKeyframe{false};
+    bool m_stop{false};
+    uint64_t m_bytesWritten{0};
+    uint64_t m_droppedFrames{0};
+    uint32_t m_files{0};
+    // Set when a file could not be created; read without the lock as
+    // m_file belongs to the background thread.
+    std::atomic<bool> m_failed{false};
+    std::thread m_thread{};
+};
+
+#endif
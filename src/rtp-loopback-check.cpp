@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "rtp-packetizer.hpp"
+
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+ * This program feeds the output of RtpPacketizer for synthetic Annex-B frames
+ * into RtpDepacketizer and compares the restored frames with the originals in
+ * both packetization modes. It returns 0 when all frames match.
+ */
+
+struct Frame {
+    std::string data{};
+    std::vector<uint32_t> nalSizes{};
+    std::string expected{};
+};
+
+static Frame makeFrame(const std::vector<uint32_t> &payloadSizes, std::mt19937 &rng) noexcept {
+    // Alternate between 3- and 4-byte start codes like x264 does; the
+    // depacketizer always restores 4-byte start codes.
+    const uint8_t HEADERS[]{0x67, 0x68, 0x65, 0x41, 0x06};
+    std::uniform_int_distribution<uint32_t> byte{1, 255};
+    Frame f;
+    for (std::size_t i{0}; i < payloadSizes.size(); i++) {
+        const std::string START_CODE{(0 == i % 2) ? std::string("\x00\x00\x00\x01", 4) : std::string("\x00\x00\x01", 3)};
+        std::string nal(1, static_cast<char>(HEADERS[i % sizeof(HEADERS)]));
+        for (uint32_t j{0}; j < payloadSizes[i]; j++) {
+            nal.push_back(static_cast<char>(byte(rng)));
+        }
+        f.data += START_CODE + nal;
+        f.nalSizes.push_back(static_cast<uint32_t>(START_CODE.size() + nal.size()));
+        f.expected += std::string("\x00\x00\x00\x01", 4) + nal;
+    }
+    return f;
+}
+
+static bool check(RtpPacketizationMode mode, const std::vector<std::vector<uint32_t>> &frames, uint32_t maxPacketSize) noexcept {
+    const char *NAME{(RtpPacketizationMode::SINGLE_NAL_UNIT == mode) ? "mode 0" : "mode 1"};
+    std::mt19937 rng{static_cast<uint32_t>(mode) + 1};
+    RtpPacketizer packetizer{maxPacketSize, mode};
+    RtpDepacketizer depacketizer;
+
+    std::size_t matching{0};
+    std::size_t packets{0};
+    int64_t microseconds{0};
+    for (const auto &payloadSizes : frames) {
+        const Frame F{makeFrame(payloadSizes, rng)};
+        cluon::data::TimeStamp ts;
+        microseconds += 40000;
+        ts.seconds(static_cast<int32_t>(microseconds / 1000000)).microseconds(static_cast<int32_t>(microseconds % 1000000));
+
+        std::vector<std::string> rtp;
+        packets += packetizer.packetize(reinterpret_cast<const uint8_t*>(F.data.data()), F.nalSizes, ts, rtp);
+
+        std::string restored;
+        uint32_t rtpTimestamp{0};
+        bool completed{false};
+        for (const auto &p : rtp) {
+            completed = depacketizer.add(reinterpret_cast<const uint8_t*>(p.data()), p.size(), restored, rtpTimestamp) || completed;
+        }
+        if (completed && (restored == F.expected)) {
+            matching++;
+        }
+        else {
+            std::cerr << "[rtp-loopback-check]: " << NAME << ": frame " << (&payloadSizes - &frames[0]) << " differs after " << rtp.size() << " packets." << std::endl;
+        }
+    }
+    const bool PASSED{(frames.size() == matching) && (0 == depacketizer.lost()) && (0 == packetizer.oversized())};
+    std::cout << "[rtp-loopback-check]: " << NAME << ": " << matching << "/" << frames.size() << " frames restored from " << packets << " packets, "
+              << depacketizer.lost() << " lost, " << packetizer.oversized() << " oversized: " << (PASSED ? "passed" : "FAILED") << std::endl;
+    return PASSED;
+}
+
+int32_t main() {
+    constexpr uint32_t MAX_PACKET_SIZE{1200};
+    // Mode 0 only carries NAL units that fit into a single packet.
+    const std::vector<std::vector<uint32_t>> SINGLE{{12, 4, 1100}, {800}, {0, 1187, 30}};
+    // Mode 1 aggregates small NAL units into STAP-A and fragments large ones
+    // into FU-A, also when both happen in the same frame.
+    const std::vector<std::vector<uint32_t>> NON_INTERLEAVED{{12, 4, 5000}, {800}, {40, 40, 40, 40}, {3000, 20, 20}, {1188, 1187, 2376}};
+
+    bool passed{check(RtpPacketizationMode::SINGLE_NAL_UNIT, SINGLE, MAX_PACKET_SIZE)};
+    passed = check(RtpPacketizationMode::NON_INTERLEAVED, NON_INTERLEAVED, MAX_PACKET_SIZE) && passed;
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rtp-packetizer.hpp"
+
+#include <algorithm>
+#include <random>
+#include <sstream>
+#include <utility>
+
+constexpr uint32_t RTP_HEADER_SIZE{12};
+constexpr uint8_t STAP_A{24};
+constexpr uint8_t FU_A{28};
+
+RtpPacketizer::RtpPacketizer(uint32_t maxPacketSize, RtpPacketizationMode mode, uint8_t payloadType) noexcept
+    : m_maxPayloadSize{std::max(maxPacketSize, RTP_HEADER_SIZE + 3) - RTP_HEADER_SIZE}
+    , m_mode{mode}
+    , m_payloadType{static_cast<uint8_t>(payloadType & 0x7f)} {
+    // RFC 3550 recommends random initial values.
+    std::random_device rd;
+    m_ssrc = rd();
+    m_sequenceNumber = static_cast<uint16_t>(rd());
+    m_timestampOffset = rd();
+}
+
+uint64_t RtpPacketizer::oversized() const noexcept {
+    return m_oversized;
+}
+
+std::string RtpPacketizer::sdp(const std::string &address, uint16_t port) const noexcept {
+    const uint32_t FIRST_OCTET{static_cast<uint32_t>(std::stoul(address.substr(0, address.find('.'))))};
+    const bool MULTICAST{(224 <= FIRST_OCTET) && (239 >= FIRST_OCTET)};
+    const uint32_t PT{m_payloadType};
+    std::stringstream sstr;
+    sstr << "v=0\r\n"
+         << "o=- " << m_ssrc << " 0 IN IP4 0.0.0.0\r\n"
+         << "s=opendlv-video-x264-encoder\r\n"
+         << "c=IN IP4 " << address << (MULTICAST ? "/1" : "") << "\r\n"
+         << "t=0 0\r\n"
+         << "m=video " << port << " RTP/AVP " << PT << "\r\n"
+         << "a=rtpmap:" << PT << " H264/90000\r\n"
+         << "a=fmtp:" << PT << " packetization-mode=" << ((RtpPacketizationMode::SINGLE_NAL_UNIT == m_mode) ? 0 : 1) << "\r\n";
+    return sstr.str();
+}
+
+void RtpPacketizer::addHeader(std::string &packet) noexcept {
+    const uint16_t SEQUENCE_NUMBER{m_sequenceNumber++};
+    const uint8_t HEADER[RTP_HEADER_SIZE]{
+        0x80, m_payloadType,
+        static_cast<uint8_t>(SEQUENCE_NUMBER >> 8), static_cast<uint8_t>(SEQUENCE_NUMBER),
+        static_cast<uint8_t>(m_timestamp >> 24), static_cast<uint8_t>(m_timestamp >> 16),
+        static_cast<uint8_t>(m_timestamp >> 8), static_cast<uint8_t>(m_timestamp),
+        static_cast<uint8_t>(m_ssrc >> 24), static_cast<uint8_t>(m_ssrc >> 16),
+        static_cast<uint8_t>(m_ssrc >> 8), static_cast<uint8_t>(m_ssrc)};
+    packet.assign(reinterpret_cast<const char*>(HEADER), RTP_HEADER_SIZE);
+}
+
+void RtpPacketizer::addFragments(const uint8_t *nal, uint32_t size, std::vector<std::string> &packets) noexcept {
+    // The NAL unit header is replaced by the FU indicator and FU header.
+    const uint8_t INDICATOR{static_cast<uint8_t>((nal[0] & 0xe0) | FU_A)};
+    const uint8_t TYPE{static_cast<uint8_t>(nal[0] & 0x1f)};
+    const uint32_t CHUNK{m_maxPayloadSize - 2};
+    for (uint32_t offset{1}; offset < size; offset += CHUNK) {
+        const uint32_t LENGTH{std::min(CHUNK, size - offset)};
+        const bool START{1 == offset};
+        const bool END{offset + LENGTH == size};
+        packets.emplace_back();
+        std::string &packet{packets.back()};
+        addHeader(packet);
+        packet.push_back(static_cast<char>(INDICATOR));
+        packet.push_back(static_cast<char>((START ? 0x80 : 0x00) | (END ? 0x40 : 0x00) | TYPE));
+        packet.append(reinterpret_cast<const char*>(nal + offset), LENGTH);
+    }
+}
+
+void RtpPacketizer::addAggregate(const std::vector<std::pair<const uint8_t*, uint32_t>> &nals, std::vector<std::string> &packets) noexcept {
+    packets.emplace_back();
+    std::string &packet{packets.back()};
+    addHeader(packet);
+    if (1 == nals.size()) {
+        packet.append(reinterpret_cast<const char*>(nals[0].first), nals[0].second);
+        return;
+    }
+    // F and NRI of the STAP-A header are the maximum of the aggregated units.
+    uint8_t forbidden{0};
+    uint8_t nri{0};
+    for (const auto &n : nals) {
+        forbidden = static_cast<uint8_t>(forbidden | (n.first[0] & 0x80));
+        nri = std::max<uint8_t>(nri, n.first[0] & 0x60);
+    }
+    packet.push_back(static_cast<char>(forbidden | nri | STAP_A));
+    for (const auto &n : nals) {
+        packet.push_back(static_cast<char>(n.second >> 8));
+        packet.push_back(static_cast<char>(n.second));
+        packet.append(reinterpret_cast<const char*>(n.first), n.second);
+    }
+}
+
+std::size_t RtpPacketizer::packetize(const uint8_t *data, const std::vector<uint32_t> &nalSizes, const cluon::data::TimeStamp &sampleTimeStamp, std::vector<std::string> &packets) noexcept {
+    // 90 kHz clock as required for video by RFC 6184.
+    const uint64_t MICROSECONDS{static_cast<uint64_t>(cluon::time::toMicroseconds(sampleTimeStamp))};
+    m_timestamp = static_cast<uint32_t>(MICROSECONDS * 9 / 100) + m_timestampOffset;
+
+    const std::size_t FIRST{packets.size()};
+    std::vector<std::pair<const uint8_t*, uint32_t>> aggregate;
+    uint32_t aggregateSize{1};
+    for (uint32_t size : nalSizes) {
+        // Strip the start code 00 00 01 or 00 00 00 01.
+        const uint8_t *nal{data};
+        uint32_t nalSize{size};
+        data += size;
+        while ( (1 < nalSize) && (0 == nal[0]) ) {
+            nal++;
+            nalSize--;
+        }
+        if ( (0 < nalSize) && (1 == nal[0]) ) {
+            nal++;
+            nalSize--;
+        }
+        if (0 == nalSize) {
+            continue;
+        }
+
+        if (RtpPacketizationMode::SINGLE_NAL_UNIT == m_mode) {
+            if (nalSize > m_maxPayloadSize) {
+                m_oversized++;
+            }
+            else {
+                addAggregate({std::make_pair(nal, nalSize)}, packets);
+            }
+            continue;
+        }
+
+        // Small NAL units, e.g., SPS, PPS, and SEI, are aggregated.
+        if ( !aggregate.empty() && (aggregateSize + 2 + nalSize > m_maxPayloadSize) ) {
+            addAggregate(aggregate, packets);
+            aggregate.clear();
+            aggregateSize = 1;
+        }
+        if (nalSize > m_maxPayloadSize) {
+            addFragments(nal, nalSize, packets);
+        }
+        else {
+            aggregate.emplace_back(nal, nalSize);
+            aggregateSize += 2 + nalSize;
+        }
+    }
+    if (!aggregate.empty()) {
+        addAggregate(aggregate, packets);
+    }
+    if (packets.size() > FIRST) {
+        packets.back()[1] = static_cast<char>(0x80 | m_payloadType);
+    }
+    return packets.size() - FIRST;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+uint64_t RtpDepacketizer::completed() const noexcept {
+    return m_completed;
+}
+
+uint64_t RtpDepacketizer::lost() const noexcept {
+    return m_lost;
+}
+
+void RtpDepacketizer::addNal(const uint8_t *nal, std::size_t size) noexcept {
+    m_frame.append("\x00\x00\x00\x01", 4);
+    m_frame.append(reinterpret_cast<const char*>(nal), size);
+}
+
+bool RtpDepacketizer::add(const uint8_t *packet, std::size_t size, std::string &frame, uint32_t &rtpTimestamp) noexcept {
+    if ( (RTP_HEADER_SIZE + 1 > size) || (2 != (packet[0] >> 6)) ) {
+        return false;
+    }
+    const uint16_t SEQUENCE_NUMBER{static_cast<uint16_t>((packet[2] << 8) | packet[3])};
+    const uint32_t TIMESTAMP{(static_cast<uint32_t>(packet[4]) << 24) | (static_cast<uint32_t>(packet[5]) << 16) | (static_cast<uint32_t>(packet[6]) << 8) | packet[7]};
+    const bool MARKER{0 != (packet[1] & 0x80)};
+    const std::size_t HEADER_SIZE{RTP_HEADER_SIZE + 4 * static_cast<std::size_t>(packet[0] & 0x0f)};
+    if (HEADER_SIZE >= size) {
+        return false;
+    }
+
+    if (m_hasSequenceNumber && (TIMESTAMP != m_timestamp)) {
+        // The previous frame ended without its last packet.
+        m_frame.clear();
+        m_corrupt = false;
+        m_inFragment = false;
+    }
+    if (m_hasSequenceNumber && (SEQUENCE_NUMBER != static_cast<uint16_t>(m_sequenceNumber + 1))) {
+        m_lost += static_cast<uint16_t>(SEQUENCE_NUMBER - m_sequenceNumber - 1);
+        m_corrupt = true;
+    }
+    m_hasSequenceNumber = true;
+    m_sequenceNumber = SEQUENCE_NUMBER;
+    m_timestamp = TIMESTAMP;
+
+    const uint8_t *payload{packet + HEADER_SIZE};
+    const std::size_t PAYLOAD_SIZE{size - HEADER_SIZE};
+    const uint8_t TYPE{static_cast<uint8_t>(payload[0] & 0x1f)};
+    if (STAP_A == TYPE) {
+        std::size_t offset{1};
+        while (offset + 2 <= PAYLOAD_SIZE) {
+            const std::size_t LENGTH{(static_cast<std::size_t>(payload[offset]) << 8) | payload[offset + 1]};
+            offset += 2;
+            if (offset + LENGTH > PAYLOAD_SIZE) {
+                m_corrupt = true;
+                break;
+            }
+            addNal(payload + offset, LENGTH);
+            offset += LENGTH;
+        }
+    }
+    else if (FU_A == TYPE) {
+        if (2 > PAYLOAD_SIZE) {
+            m_corrupt = true;
+        }
+        else {
+            const bool START{0 != (payload[1] & 0x80)};
+            const bool END{0 != (payload[1] & 0x40)};
+            if (START) {
+                const uint8_t HEADER{static_cast<uint8_t>((payload[0] & 0xe0) | (payload[1] & 0x1f))};
+                addNal(&HEADER, 1);
+                m_inFragment = true;
+            }
+            else if (!m_inFragment) {
+                m_corrupt = true;
+            }
+            m_frame.append(reinterpret_cast<const char*>(payload + 2), PAYLOAD_SIZE - 2);
+            m_inFragment = m_inFragment && !END;
+        }
+    }
+    else {
+        addNal(payload, PAYLOAD_SIZE);
+    }
+
+    if (!MARKER) {
+        return false;
+    }
+    const bool COMPLETE{!m_corrupt && !m_inFragment && !m_frame.empty()};
+    if (COMPLETE) {
+        frame.swap(m_frame);
+        rtpTimestamp = m_timestamp;
+        m_completed++;
+    }
+    m_frame.clear();
+    m_corrupt = false;
+    m_inFragment = false;
+    return COMPLETE;
+}
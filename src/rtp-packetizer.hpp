@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RTP_PACKETIZER_HPP
+#define RTP_PACKETIZER_HPP
+
+#include "cluon-complete.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * RFC 6184 packetization modes: SINGLE_NAL_UNIT (mode 0) sends every NAL unit
+ * in its own packet; NON_INTERLEAVED (mode 1) additionally aggregates small
+ * NAL units into STAP-A packets and fragments large ones into FU-A packets.
+ */
+enum class RtpPacketizationMode {
+    SINGLE_NAL_UNIT,
+    NON_INTERLEAVED,
+};
+
+/**
+ * This class packetizes the Annex-B NAL units of one frame from x264 into RTP
+ * packets according to RFC 6184 so that standard tools, e.g., GStreamer's
+ * rtph264depay, can receive the stream without OpenDLV; the marker bit is
+ * set on the last packet of every frame.
+ */
+class RtpPacketizer {
+   private:
+    RtpPacketizer(const RtpPacketizer &) = delete;
+    RtpPacketizer(RtpPacketizer &&)      = delete;
+    RtpPacketizer &operator=(const RtpPacketizer &) = delete;
+    RtpPacketizer &operator=(RtpPacketizer &&) = delete;
+
+   public:
+    /**
+     * @param maxPacketSize Largest RTP packet including the RTP header, e.g.,
+     *                      the MTU minus IP and UDP headers.
+     * @param mode Packetization mode.
+     * @param payloadType Dynamic RTP payload type.
+     */
+    RtpPacketizer(uint32_t maxPacketSize, RtpPacketizationMode mode, uint8_t payloadType = 96) noexcept;
+
+    /**
+     * This method appends the RTP packets for one frame to packets.
+     *
+     * @param data NAL units of the frame back to back, each with start code.
+     * @param nalSizes Sizes of the NAL units including their start codes.
+     * @param sampleTimeStamp Sample time stamp of the frame.
+     * @return Number of packets appended.
+     */
+    std::size_t packetize(const uint8_t *data, const std::vector<uint32_t> &nalSizes, const cluon::data::TimeStamp &sampleTimeStamp, std::vector<std::string> &packets) noexcept;
+
+    /**
+     * @return Session description for receivers of the given destination.
+     */
+    std::string sdp(const std::string &address, uint16_t port) const noexcept;
+
+    /**
+     * @return Number of NAL units that did not fit into a packet in
+     *         SINGLE_NAL_UNIT mode and were dropped.
+     */
+    uint64_t oversized() const noexcept;
+
+   private:
+    void addHeader(std::string &packet) noexcept;
+    void addFragments(const uint8_t *nal, uint32_t size, std::vector<std::string> &packets) noexcept;
+    void addAggregate(const std::vector<std::pair<const uint8_t*, uint32_t>> &nals, std::vector<std::string> &packets) noexcept;
+
+   private:
+    const uint32_t m_maxPayloadSize;
+    const RtpPacketizationMode m_mode;
+    const uint8_t m_payloadType;
+    uint32_t m_ssrc{0};
+    uint16_t m_sequenceNumber{0};
+    uint32_t m_timestampOffset{0};
+    uint32_t m_timestamp{0};
+    uint64_t m_oversized{0};
+};
+
+/**
+ * This class restores the Annex-B frames from the RTP packets of an
+ * RtpPacketizer and serves as reference implementation to check the
+ * packetization; frames with missing packets are discarded.
+ */
+class RtpDepacketizer {
+   private:
+    RtpDepacketizer(const RtpDepacketizer &) = delete;
+    RtpDepacketizer(RtpDepacketizer &&)      = delete;
+    RtpDepacketizer &operator=(const RtpDepacketizer &) = delete;
+    RtpDepacketizer &operator=(RtpDepacketizer &&) = delete;
+
+   public:
+    RtpDepacketizer() = default;
+
+    /**
+     * This method adds one RTP packet.
+     *
+     * @param frame The completed frame with start codes if true is returned.
+     * @param rtpTimestamp RTP timestamp of the completed frame.
+     * @return true if the packet completed a frame.
+     */
+    bool add(const uint8_t *packet, std::size_t size, std::string &frame, uint32_t &rtpTimestamp) noexcept;
+
+    /**
+     * @return Number of frames restored so far.
+     */
+    uint64_t completed() const noexcept;
+
+    /**
+     * @return Number of packets missing in the sequence so far.
+     */
+    uint64_t lost() const noexcept;
+
+   private:
+    void addNal(const uint8_t *nal, std::size_t size) noexcept;
+
+   private:
+    std::string m_frame{};
+    bool m_hasSequenceNumber{false};
+    uint16_t m_sequenceNumber{0};
+    uint32_t m_timestamp{0};
+    bool m_corrupt{false};
+    bool m_inFragment{false};
+    uint64_t m_completed{0};
+    uint64_t m_lost{0};
+};
+
+#endif
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "shared-memory-ring.hpp"
+#include "frame-buffer-pool.hpp"
+
+#include <climits>
+#include <cstring>
+#include <ctime>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace SharedMemoryRing {
+    static uint32_t align(uint32_t v) noexcept {
+        return (v + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    }
+
+    static_assert(sizeof(uint32_t) == sizeof(std::atomic<uint32_t>), "header.newest must be usable as futex.");
+
+    static void futex(std::atomic<uint32_t> *address, int op, uint32_t value, const struct timespec *timeout = nullptr) noexcept {
+        // Interruptions, timeouts, and values that changed meanwhile are left to the caller's check.
+        (void)::syscall(SYS_futex, reinterpret_cast<uint32_t*>(address), op, value, timeout, nullptr, 0);
+    }
+
+    uint32_t sizeOf(uint32_t numberOfSlots, uint32_t slotSize) noexcept {
+        return static_cast<uint32_t>(sizeof(SharedMemoryRingHeader))
+            + numberOfSlots * static_cast<uint32_t>(sizeof(SharedMemoryRingSlotHeader))
+            + numberOfSlots * align(slotSize);
+    }
+}
+
+SharedMemoryRingReader::SharedMemoryRingReader(char *data, uint32_t size) noexcept {
+    if ( (nullptr != data) && (sizeof(SharedMemoryRingHeader) <= size) ) {
+        SharedMemoryRingHeader *header{reinterpret_cast<SharedMemoryRingHeader*>(data)};
+        if ( (SharedMemoryRing::MAGIC == header->magic) &&
+             (SharedMemoryRing::VERSION == header->version) &&
+             (0 < header->numberOfSlots) &&
+             (SharedMemoryRing::sizeOf(header->numberOfSlots, header->slotSize) <= size) ) {
+            m_header = header;
+            m_slotHeaders = reinterpret_cast<SharedMemoryRingSlotHeader*>(data + sizeof(SharedMemoryRingHeader));
+            m_slots = reinterpret_cast<uint8_t*>(data + sizeof(SharedMemoryRingHeader) + header->numberOfSlots * sizeof(SharedMemoryRingSlotHeader));
+            m_alignedSlotSize = SharedMemoryRing::align(header->slotSize);
+            // Only frames published after attaching are of interest.
+            m_lastRead = m_header->newest.load(std::memory_order_acquire);
+        }
+    }
+}
+
+bool SharedMemoryRingReader::valid() const noexcept {
+    return (nullptr != m_header);
+}
+
+uint32_t SharedMemoryRingReader::slotSize() const noexcept {
+    return (nullptr != m_header) ? m_header->slotSize : 0;
+}
+
+bool SharedMemoryRingReader::hasNewFrame() const noexcept {
+    return (nullptr != m_header) && (m_header->newest.load(std::memory_order_acquire) != m_lastRead);
+}
+
+bool SharedMemoryRingReader::waitForNewFrame() noexcept {
+    if (nullptr == m_header) {
+        return false;
+    }
+    if (!hasNewFrame()) {
+        // Sleeps only while header.newest still equals the last frame read;
+        // the timeout bounds a wakeUp() that arrives just before the sleep.
+        const struct timespec TIMEOUT{0, 100 * 1000 * 1000};
+        SharedMemoryRing::futex(&m_header->newest, FUTEX_WAIT, m_lastRead, &TIMEOUT);
+    }
+    return hasNewFrame();
+}
+
+void SharedMemoryRingReader::wakeUp() noexcept {
+    if (nullptr != m_header) {
+        SharedMemoryRing::futex(&m_header->newest, FUTEX_WAKE, INT_MAX);
+    }
+}
+
+bool SharedMemoryRingReader::readNewest(uint8_t *dst, uint32_t length, int64_t &sampleTimeStampInMicroseconds) noexcept {
+    if ( (nullptr == m_header) || (length > m_header->slotSize) ) {
+        return false;
+    }
+
+    // The writer might overtake us while copying; retry a few times with the
+    // then newest frame before giving up on this notification.
+    constexpr uint32_t MAX_ATTEMPTS{3};
+    for (uint32_t attempt{0}; attempt < MAX_ATTEMPTS; attempt++) {
+        const uint32_t NEWEST{m_header->newest.load(std::memory_order_acquire)};
+        if ( (0 == NEWEST) || (NEWEST == m_lastRead) ) {
+            return false;
+        }
+        const uint32_t INDEX{(NEWEST - 1) % m_header->numberOfSlots};
+        SharedMemoryRingSlotHeader &slot{m_slotHeaders[INDEX]};
+
+        const uint32_t EXPECTED{2 * NEWEST};
+        const uint32_t BEFORE{slot.sequence.load(std::memory_order_acquire)};
+        if (EXPECTED == BEFORE) {
+            const int64_t SAMPLE_TIME{slot.sampleTimeStampInMicroseconds};
+            copyFrame(dst, m_slots + static_cast<std::size_t>(INDEX) * m_alignedSlotSize, length);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            const uint32_t AFTER{slot.sequence.load(std::memory_order_relaxed)};
+            if (BEFORE == AFTER) {
+                if (NEWEST > m_lastRead + 1) {
+                    m_skipped += (NEWEST - m_lastRead - 1);
+                }
+                m_lastRead = NEWEST;
+                sampleTimeStampInMicroseconds = SAMPLE_TIME;
+                return true;
+            }
+        }
+        m_torn++;
+    }
+    return false;
+}
+
+uint64_t SharedMemoryRingReader::skipped() const noexcept {
+    return m_skipped;
+}
+
+uint64_t SharedMemoryRingReader::torn() const noexcept {
+    return m_torn;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+SharedMemoryRingWriter::SharedMemoryRingWriter(char *data, uint32_t size, uint32_t numberOfSlots, uint32_t slotSize) noexcept {
+    if ( (nullptr != data) && (0 < numberOfSlots) && (SharedMemoryRing::sizeOf(numberOfSlots, slotSize) <= size) ) {
+        std::memset(data, 0, SharedMemoryRing::sizeOf(numberOfSlots, slotSize));
+        m_header = reinterpret_cast<SharedMemoryRingHeader*>(data);
+        m_header->numberOfSlots = numberOfSlots;
+        m_header->slotSize = slotSize;
+        m_header->newest.store(0, std::memory_order_relaxed);
+        m_slotHeaders = reinterpret_cast<SharedMemoryRingSlotHeader*>(data + sizeof(SharedMemoryRingHeader));
+        m_slots = reinterpret_cast<uint8_t*>(data + sizeof(SharedMemoryRingHeader) + numberOfSlots * sizeof(SharedMemoryRingSlotHeader));
+        m_alignedSlotSize = SharedMemoryRing::align(slotSize);
+        m_header->version = SharedMemoryRing::VERSION;
+        std::atomic_thread_fence(std::memory_order_release);
+        // The magic is written last so that readers never see a half-initialized ring.
+        m_header->magic = SharedMemoryRing::MAGIC;
+    }
+}
+
+bool SharedMemoryRingWriter::valid() const noexcept {
+    return (nullptr != m_header);
+}
+
+void SharedMemoryRingWriter::publish(const uint8_t *src, uint32_t length, int64_t sampleTimeStampInMicroseconds) noexcept {
+    if ( (nullptr == m_header) || (length > m_header->slotSize) ) {
+        return;
+    }
+    const uint32_t FRAME{++m_frame};
+    const uint32_t INDEX{(FRAME - 1) % m_header->numberOfSlots};
+    SharedMemoryRingSlotHeader &slot{m_slotHeaders[INDEX]};
+
+    slot.sequence.store(2 * FRAME - 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.sampleTimeStampInMicroseconds = sampleTimeStampInMicroseconds;
+    std::memcpy(m_slots + static_cast<std::size_t>(INDEX) * m_alignedSlotSize, src, length);
+    slot.sequence.store(2 * FRAME, std::memory_order_release);
+    m_header->newest.store(FRAME, std::memory_order_release);
+    SharedMemoryRing::futex(&m_header->newest, FUTEX_WAKE, INT_MAX);
+}
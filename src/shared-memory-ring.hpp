@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SHARED_MEMORY_RING_HPP
+#define SHARED_MEMORY_RING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Layout of a shared memory area holding a ring of frame slots; all offsets
+ * are relative to cluon::SharedMemory::data():
+ *
+ *   [RingHeader][SlotHeader 0 .. N-1][slot 0 .. N-1]
+ *
+ * Every header and every slot start at a multiple of 64 bytes. Frames are
+ * numbered from 1 and frame n lives in slot (n - 1) % N. The writer publishes
+ * a frame as follows:
+ *
+ *   1. slot.sequence = 2n - 1 (odd: slot is being written)
+ *   2. write sampleTimeStamp and the frame bytes
+ *   3. slot.sequence = 2n     (even: slot holds complete frame n)
+ *   4. header.newest = n
+ *   5. futex(&header.newest, FUTEX_WAKE, INT_MAX)
+ *
+ * The writer never takes the shared memory lock. A reader picks header.newest,
+ * copies the corresponding slot, and compares slot.sequence before and after
+ * the copy to detect frames that were overwritten while being read. A reader
+ * waiting for a frame sleeps with FUTEX_WAIT on header.newest and the number
+ * of the last frame it read, so that the kernel does not let it sleep if a
+ * frame was published in between; cluon::SharedMemory::wait() cannot check
+ * such a condition under its lock.
+ */
+struct SharedMemoryRingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t numberOfSlots;
+    uint32_t slotSize;
+    std::atomic<uint32_t> newest;
+    uint8_t reserved[44];
+};
+
+struct SharedMemoryRingSlotHeader {
+    std::atomic<uint32_t> sequence;
+    uint32_t reserved0;
+    int64_t sampleTimeStampInMicroseconds;
+    uint8_t reserved1[48];
+};
+
+static_assert(64 == sizeof(SharedMemoryRingHeader), "SharedMemoryRingHeader must occupy 64 bytes.");
+static_assert(64 == sizeof(SharedMemoryRingSlotHeader), "SharedMemoryRingSlotHeader must occupy 64 bytes.");
+
+namespace SharedMemoryRing {
+    constexpr uint32_t MAGIC{0x52494E47}; // 'RING'
+    constexpr uint32_t VERSION{1};
+    constexpr uint32_t ALIGNMENT{64};
+
+    /**
+     * @return Number of bytes required for a ring with the given geometry.
+     */
+    uint32_t sizeOf(uint32_t numberOfSlots, uint32_t slotSize) noexcept;
+}
+
+/**
+ * This class reads the newest complete frame from a ring-structured shared
+ * memory area without blocking the writer.
+ */
+class SharedMemoryRingReader {
+   private:
+    SharedMemoryRingReader(const SharedMemoryRingReader &) = delete;
+    SharedMemoryRingReader(SharedMemoryRingReader &&)      = delete;
+    SharedMemoryRingReader &operator=(const SharedMemoryRingReader &) = delete;
+    SharedMemoryRingReader &operator=(SharedMemoryRingReader &&) = delete;
+
+   public:
+    /**
+     * @param data Pointer to the user-accessible part of the shared memory.
+     * @param size Size of the user-accessible part of the shared memory.
+     */
+    SharedMemoryRingReader(char *data, uint32_t size) noexcept;
+
+    /**
+     * @return true if the shared memory area holds a valid ring.
+     */
+    bool valid() const noexcept;
+
+    /**
+     * @return Size in bytes of one slot.
+     */
+    uint32_t slotSize() const noexcept;
+
+    /**
+     * @return true if a frame newer than the last one read is available.
+     */
+    bool hasNewFrame() const noexcept;
+
+    /**
+     * This method blocks until a frame newer than the last one read is
+     * published, wakeUp() is called, or 100 ms passed.
+     *
+     * @return true if a new frame is available.
+     */
+    bool waitForNewFrame() noexcept;
+
+    /**
+     * This method wakes up all readers blocked in waitForNewFrame().
+     */
+    void wakeUp() noexcept;
+
+    /**
+     * This method copies the newest complete frame.
+     *
+     * @param dst Destination buffer.
+     * @param length Number of bytes to copy (must not exceed slotSize()).
+     * @param sampleTimeStampInMicroseconds Sample time stamp of the frame.
+     * @return true if a consistent, new frame was copied.
+     */
+    bool readNewest(uint8_t *dst, uint32_t length, int64_t &sampleTimeStampInMicroseconds) noexcept;
+
+    /**
+     * @return Number of frames that were published but never read.
+     */
+    uint64_t skipped() const noexcept;
+
+    /**
+     * @return Number of frames that were overwritten while being read.
+     */
+    uint64_t torn() const noexcept;
+
+   private:
+    SharedMemoryRingHeader *m_header{nullptr};
+    SharedMemoryRingSlotHeader *m_slotHeaders{nullptr};
+    uint8_t *m_slots{nullptr};
+    uint32_t m_alignedSlotSize{0};
+    uint32_t m_lastRead{0};
+    uint64_t m_skipped{0};
+    uint64_t m_torn{0};
+};
+
+/**
+ * This class publishes frames into a ring-structured shared memory area and
+ * serves as reference implementation for producers.
+ */
+class SharedMemoryRingWriter {
+   private:
+    SharedMemoryRingWriter(const SharedMemoryRingWriter &) = delete;
+    SharedMemoryRingWriter(SharedMemoryRingWriter &&)      = delete;
+    SharedMemoryRingWriter &operator=(const SharedMemoryRingWriter &) = delete;
+    SharedMemoryRingWriter &operator=(SharedMemoryRingWriter &&) = delete;
+
+   public:
+    /**
+     * Initializes the ring header; size must be at least
+     * SharedMemoryRing::sizeOf(numberOfSlots, slotSize).
+     */
+    SharedMemoryRingWriter(char *data, uint32_t size, uint32_t numberOfSlots, uint32_t slotSize) noexcept;
+
+    bool valid() const noexcept;
+
+    /**
+     * This method publishes a frame into the next slot and wakes up the
+     * waiting readers.
+     */
+    void publish(const uint8_t *src, uint32_t length, int64_t sampleTimeStampInMicroseconds) noexcept;
+
+   private:
+    SharedMemoryRingHeader *m_header{nullptr};
+    SharedMemoryRingSlotHeader *m_slotHeaders{nullptr};
+    uint8_t *m_slots{nullptr};
+    uint32_t m_alignedSlotSize{0};
+    uint32_t m_frame{0};
+};
+
+#endif
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SPSC_QUEUE_HPP
+#define SPSC_QUEUE_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Bounded lock-free queue for exactly one producer and one consumer thread.
+ * Elements are constructed once and filled in place so that buffers inside
+ * them keep their capacity from one use to the next:
+ *
+ *   Producer: T *e = q.back(); if (e) { fill(*e); q.push(); }
+ *   Consumer: if (0 < q.size()) { use(*q.at(0)); q.pop(); }
+ *
+ * The consumer may access and modify all elements at(0) .. at(size() - 1)
+ * as the producer only writes behind them.
+ */
+template <typename T>
+class SpscQueue {
+   private:
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue(SpscQueue &&)      = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+    SpscQueue &operator=(SpscQueue &&) = delete;
+
+   public:
+    /**
+     * @param capacity Number of elements, rounded up to a power of two.
+     */
+    explicit SpscQueue(uint32_t capacity) noexcept {
+        uint32_t c{1};
+        while (c < capacity) {
+            c <<= 1;
+        }
+        m_mask = c - 1;
+        m_elements.resize(c);
+    }
+    ~SpscQueue() = default;
+
+    uint32_t capacity() const noexcept {
+        return m_mask + 1;
+    }
+
+    /**
+     * @return Number of elements in the queue; exact for the consumer, a
+     *         lower bound of the free space for the producer.
+     */
+    uint32_t size() const noexcept {
+        return m_head.load(std::memory_order_acquire) - m_tail.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Producer: @return Element to fill or nullptr if the queue is full.
+     */
+    T *back() noexcept {
+        const uint32_t HEAD{m_head.load(std::memory_order_relaxed)};
+        if ((HEAD - m_tail.load(std::memory_order_acquire)) > m_mask) {
+            return nullptr;
+        }
+        return &m_elements[HEAD & m_mask];
+    }
+
+    /**
+     * Producer: Appends the element returned by back().
+     */
+    void push() noexcept {
+        m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /**
+     * Consumer: @return i-th oldest element; i must be less than size().
+     */
+    T *at(uint32_t i) noexcept {
+        return &m_elements[(m_tail.load(std::memory_order_relaxed) + i) & m_mask];
+    }
+
+    /**
+     * Consumer: Removes the oldest element.
+     */
+    void pop() noexcept {
+        m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+   private:
+    std::vector<T> m_elements{};
+    uint32_t m_mask{0};
+    // Head and tail are kept on separate cache lines to avoid false sharing.
+    uint8_t m_padding0[64]{};
+    std::atomic<uint32_t> m_head{0};
+    uint8_t m_padding1[64]{};
+    std::atomic<uint32_t> m_tail{0};
+};
+
+#endif
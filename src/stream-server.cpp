@@ -0,0 +1,267 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stream-server.hpp"
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+StreamServer::StreamServer(const std::string &path, uint32_t maxQueuedEnvelopes) noexcept
+    : StreamServer(Type::UNIX_SEQPACKET, path, 0, maxQueuedEnvelopes) {}
+
+StreamServer::StreamServer(uint16_t port, uint32_t maxQueuedEnvelopes) noexcept
+    : StreamServer(Type::TCP, "", port, maxQueuedEnvelopes) {}
+
+StreamServer::StreamServer(Type type, const std::string &path, uint16_t port, uint32_t maxQueuedEnvelopes) noexcept
+    : m_type{type}
+    , m_path{path}
+    , m_maxQueuedEnvelopes{maxQueuedEnvelopes} {
+    int32_t s{-1};
+    if (Type::UNIX_SEQPACKET == m_type) {
+        struct sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (m_path.size() < sizeof(addr.sun_path)) {
+            std::strncpy(addr.sun_path, m_path.c_str(), sizeof(addr.sun_path) - 1);
+            // A socket file left over from a previous run would make bind fail.
+            ::unlink(m_path.c_str());
+            s = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+            if ( !(s < 0) && (0 != ::bind(s, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr))) ) {
+                ::close(s);
+                s = -1;
+            }
+        }
+    }
+    else {
+        struct sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        s = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, IPPROTO_TCP);
+        if (!(s < 0)) {
+            int32_t reuse{1};
+            ::setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+            if (0 != ::bind(s, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr))) {
+                ::close(s);
+                s = -1;
+            }
+        }
+    }
+    if ( !(s < 0) && (0 == ::listen(s, 8)) && (0 == ::pipe2(m_wakeup, O_NONBLOCK | O_CLOEXEC)) ) {
+        ::fcntl(s, F_SETFL, O_NONBLOCK);
+        m_socket = s;
+        m_thread = std::thread(&StreamServer::run, this);
+    }
+    else if (!(s < 0)) {
+        ::close(s);
+    }
+}
+
+StreamServer::~StreamServer() noexcept {
+    m_stop.store(true);
+    if (m_thread.joinable()) {
+        wakeUp();
+        m_thread.join();
+    }
+    for (auto &c : m_clients) {
+        ::close(c->socket);
+    }
+    for (auto fd : m_wakeup) {
+        if (!(fd < 0)) {
+            ::close(fd);
+        }
+    }
+    if (!(m_socket < 0)) {
+        ::close(m_socket);
+        if (Type::UNIX_SEQPACKET == m_type) {
+            ::unlink(m_path.c_str());
+        }
+    }
+}
+
+bool StreamServer::valid() const noexcept {
+    return !(m_socket < 0);
+}
+
+uint32_t StreamServer::clients() noexcept {
+    std::lock_guard<std::mutex> lck(m_clientsMutex);
+    return static_cast<uint32_t>(m_clients.size());
+}
+
+uint64_t StreamServer::droppedClients() const noexcept {
+    return m_droppedClients.load();
+}
+
+void StreamServer::publish(const std::string &envelope) noexcept {
+    if (m_socket < 0) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lck(m_clientsMutex);
+        if (m_clients.empty()) {
+            return;
+        }
+    }
+
+    // The same buffer is shared among all clients.
+    const uint32_t LENGTH{static_cast<uint32_t>(envelope.size())};
+    std::shared_ptr<std::string> record{std::make_shared<std::string>()};
+    record->reserve(sizeof(LENGTH) + envelope.size());
+    for (uint32_t i{0}; i < sizeof(LENGTH); i++) {
+        record->push_back(static_cast<char>((LENGTH >> (8 * i)) & 0xFF));
+    }
+    record->append(envelope);
+    {
+        std::lock_guard<std::mutex> lck(m_clientsMutex);
+        for (auto &c : m_clients) {
+            if (c->queue.size() < m_maxQueuedEnvelopes) {
+                c->queue.push_back(record);
+            }
+            else {
+                c->slow = true;
+            }
+        }
+    }
+    wakeUp();
+}
+
+void StreamServer::wakeUp() noexcept {
+    // A full pipe (EAGAIN) already wakes the background thread.
+    const char WAKEUP{0};
+    ssize_t written{-1};
+    do {
+        written = ::write(m_wakeup[1], &WAKEUP, 1);
+    } while ( (0 > written) && (EINTR == errno) );
+}
+
+void StreamServer::accept() noexcept {
+    const int32_t CLIENT{::accept4(m_socket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)};
+    if (CLIENT < 0) {
+        return;
+    }
+    if (Type::TCP == m_type) {
+        int32_t noDelay{1};
+        ::setsockopt(CLIENT, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    }
+    std::unique_ptr<Client> client{new Client()};
+    client->socket = CLIENT;
+    std::lock_guard<std::mutex> lck(m_clientsMutex);
+    m_clients.push_back(std::move(client));
+}
+
+bool StreamServer::write(Client &client) noexcept {
+    // Only this thread removes Envelopes, so the front stays valid while
+    // other threads append.
+    while (true) {
+        std::shared_ptr<const std::string> record;
+        {
+            std::lock_guard<std::mutex> lck(m_clientsMutex);
+            if (client.queue.empty()) {
+                return true;
+            }
+            record = client.queue.front();
+        }
+        // A packet of a SOCK_SEQPACKET socket must fit into its send buffer.
+        constexpr std::size_t MAX_PACKET_SIZE{65536};
+        const std::size_t LENGTH{(Type::UNIX_SEQPACKET == m_type) ? std::min(MAX_PACKET_SIZE, record->size() - client.offset) : (record->size() - client.offset)};
+        const ssize_t WRITTEN{::send(client.socket, record->data() + client.offset, LENGTH, MSG_NOSIGNAL)};
+        if (WRITTEN < 0) {
+            return (EAGAIN == errno) || (EWOULDBLOCK == errno) || (EINTR == errno);
+        }
+        client.offset += static_cast<std::size_t>(WRITTEN);
+        if (client.offset < record->size()) {
+            return true;
+        }
+        client.offset = 0;
+        std::lock_guard<std::mutex> lck(m_clientsMutex);
+        client.queue.pop_front();
+    }
+}
+
+void StreamServer::run() noexcept {
+    std::vector<struct pollfd> fds;
+    std::vector<Client*> polled;
+    while (!m_stop.load()) {
+        fds.clear();
+        polled.clear();
+        fds.push_back(pollfd{m_socket, POLLIN, 0});
+        fds.push_back(pollfd{m_wakeup[0], POLLIN, 0});
+        {
+            std::lock_guard<std::mutex> lck(m_clientsMutex);
+            for (auto &c : m_clients) {
+                fds.push_back(pollfd{c->socket, static_cast<int16_t>(c->queue.empty() ? 0 : POLLOUT), 0});
+                polled.push_back(c.get());
+            }
+        }
+        constexpr int32_t TIMEOUT_IN_MS{100};
+        if (0 > ::poll(fds.data(), fds.size(), TIMEOUT_IN_MS)) {
+            continue;
+        }
+        if (0 != (fds[1].revents & POLLIN)) {
+            char buffer[64];
+            while (0 < ::read(m_wakeup[0], buffer, sizeof(buffer))) {}
+        }
+
+        std::vector<Client*> disconnected;
+        for (std::size_t i{0}; i < polled.size(); i++) {
+            Client *c{polled[i]};
+            const int16_t EVENTS{fds[i + 2].revents};
+            bool ok{0 == (EVENTS & (POLLERR | POLLHUP | POLLNVAL))};
+            if (ok && (0 != (EVENTS & POLLOUT))) {
+                ok = write(*c);
+            }
+            {
+                std::lock_guard<std::mutex> lck(m_clientsMutex);
+                if (c->slow) {
+                    m_droppedClients++;
+                    ok = false;
+                }
+            }
+            if (!ok) {
+                disconnected.push_back(c);
+            }
+        }
+        if (!disconnected.empty()) {
+            std::lock_guard<std::mutex> lck(m_clientsMutex);
+            for (Client *c : disconnected) {
+                ::close(c->socket);
+                for (auto it{m_clients.begin()}; it != m_clients.end(); ++it) {
+                    if (it->get() == c) {
+                        m_clients.erase(it);
+                        break;
+                    }
+                }
+            }
+        }
+
+        if (0 != (fds[0].revents & POLLIN)) {
+            accept();
+        }
+    }
+}
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2018  Christian Berger
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STREAM_SERVER_HPP
+#define STREAM_SERVER_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * This class serves Envelopes to local or remote consumers that connect to a
+ * Unix domain socket of type SOCK_SEQPACKET or to a TCP port. Every Envelope
+ * is sent as
+ *
+ *   LEN0 LEN1 LEN2 LEN3 0x0D 0xA4 ... (Envelope as sent to an OD4Session)
+ *
+ * where LEN0..LEN3 is the little Endian length of the following bytes. Unlike
+ * datagrams, Envelopes are not limited in size; on a SOCK_SEQPACKET socket,
+ * every Envelope starts a new packet and Envelopes larger than 64 KiB continue
+ * in the following packets of up to 64 KiB each.
+ *
+ * Publishing never blocks: every client has its own queue of at most
+ * maxQueuedEnvelopes Envelopes, which a background thread writes to the
+ * client's non-blocking socket; clients whose queue is full are disconnected.
+ */
+class StreamServer {
+   private:
+    StreamServer(const StreamServer &) = delete;
+    StreamServer(StreamServer &&)      = delete;
+    StreamServer &operator=(const StreamServer &) = delete;
+    StreamServer &operator=(StreamServer &&) = delete;
+
+   private:
+    enum class Type {
+        UNIX_SEQPACKET,
+        TCP,
+    };
+
+    StreamServer(Type type, const std::string &path, uint16_t port, uint32_t maxQueuedEnvelopes) noexcept;
+
+   public:
+    /**
+     * @param path Path of the Unix domain socket of type SOCK_SEQPACKET.
+     * @param maxQueuedEnvelopes Number of Envelopes that may wait per client.
+     */
+    StreamServer(const std::string &path, uint32_t maxQueuedEnvelopes) noexcept;
+
+    /**
+     * @param port TCP port to listen on at all interfaces.
+     * @param maxQueuedEnvelopes Number of Envelopes that may wait per client.
+     */
+    StreamServer(uint16_t port, uint32_t maxQueuedEnvelopes) noexcept;
+    ~StreamServer() noexcept;
+
+    /**
+     * @return true if the server is listening.
+     */
+    bool valid() const noexcept;
+
+    /**
+     * This method queues the given serialized Envelope for all connected
+     * clients; it may be called from any thread.
+     */
+    void publish(const std::string &envelope) noexcept;
+
+    /**
+     * @return Number of connected clients.
+     */
+    uint32_t clients() noexcept;
+
+    /**
+     * @return Number of clients disconnected for being too slow.
+     */
+    uint64_t droppedClients() const noexcept;
+
+   private:
+    struct Client {
+        int32_t socket{-1};
+        std::deque<std::shared_ptr<const std::string>> queue{};
+        std::size_t offset{0};  // bytes of queue.front() already written
+        bool slow{false};
+    };
+
+    void run() noexcept;
+    void wakeUp() noexcept;
+    void accept() noexcept;
+    bool write(Client &client) noexcept;
+
+   private:
+    const Type m_type;
+    const std::string m_path;
+    const uint32_t m_maxQueuedEnvelopes;
+    int32_t m_socket{-1};
+    // Wakes the background thread when new Envelopes are queued.
+    int32_t m_wakeup[2]{-1, -1};
+
+    std::mutex m_clientsMutex{};
+    std::vector<std::unique_ptr<Client>> m_clients{};
+    std::atomic<uint64_t> m_droppedClients{0};
+
+    std::atomic<bool> m_stop{false};
+    std::thread m_thread{};
+};
+
+#endif